@@ -0,0 +1,336 @@
+//
+// Benchmark.cpp : times the parts of ResampleStockData, and whole runs, on generated data
+//
+// Results are written as JSON (to stdout, or to the file given with --json), one entry per benchmark, so runs can be
+// compared to catch regressions. A summary goes to stderr.
+//
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../ResampleStockData/ResampleLibrary.h"
+#include "../ResampleStockData/ResampleStockData.h"
+#include "StockDataGenerator.h"
+
+using std::endl;
+using std::string;
+
+namespace {
+
+struct Result {
+    string name;
+    uint64_t iterations{ 0 };
+    double mean_seconds{ 0 }; // per iteration
+    double best_seconds{ 0 };
+    uint64_t items{ 0 };      // per iteration: lines, days, ...
+    uint64_t bytes{ 0 };      // per iteration, if it makes sense
+};
+
+struct BenchmarkOptions {
+    GeneratorConfig data;
+    double min_seconds{ 0.5 }; // per benchmark
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "resample_bench";
+    std::filesystem::path json_path;
+    string filter; // only benchmarks whose name contains this
+};
+
+uint64_t sink = 0; // results go here (and it is printed), so the compiler can't drop the work
+
+// runs run once to warm up, then again until min_seconds have passed
+Result measure(const BenchmarkOptions& options, const string& name, uint64_t items, uint64_t bytes, const std::function<void()>& run) {
+    Result result{ name, 0, 0, 0, items, bytes };
+    run();
+    double total = 0;
+    result.best_seconds = 1e300;
+    while (total < options.min_seconds || result.iterations == 0) {
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        total += seconds;
+        result.best_seconds = std::min(result.best_seconds, seconds);
+        result.iterations++;
+    }
+    result.mean_seconds = total / result.iterations;
+
+    char message[200];
+    snprintf(message, sizeof(message), "%-32s %10.3f ms %10.2f ns/item %10.1f MB/s", name.c_str(), result.mean_seconds * 1e3,
+        items ? result.mean_seconds * 1e9 / items : 0.0, bytes ? bytes / (1024.0 * 1024.0) / result.mean_seconds : 0.0);
+    std::cerr << message << endl;
+    return result;
+}
+
+void writeJson(std::ostream& out, const BenchmarkOptions& options, uint64_t lines, uint64_t input_bytes, const std::vector<Result>& results) {
+    out << "{" << endl;
+    out << "  \"config\": { \"years\": " << options.data.years << ", \"bar_minutes\": " << options.data.bar_minutes
+        << ", \"seed\": " << options.data.seed << ", \"lines\": " << lines << ", \"input_bytes\": " << input_bytes
+        << ", \"hardware_threads\": " << std::thread::hardware_concurrency() << " }," << endl;
+    out << "  \"results\": [" << endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        char line[400];
+        snprintf(line, sizeof(line),
+            "    { \"name\": \"%s\", \"iterations\": %llu, \"mean_seconds\": %.9f, \"best_seconds\": %.9f, \"items\": %llu, "
+            "\"ns_per_item\": %.3f, \"bytes\": %llu, \"mb_per_second\": %.3f }%s",
+            r.name.c_str(), (unsigned long long)r.iterations, r.mean_seconds, r.best_seconds, (unsigned long long)r.items,
+            r.items ? r.mean_seconds * 1e9 / r.items : 0.0, (unsigned long long)r.bytes,
+            r.bytes ? r.bytes / (1024.0 * 1024.0) / r.mean_seconds : 0.0, i + 1 < results.size() ? "," : "");
+        out << line << endl;
+    }
+    out << "  ]" << endl << "}" << endl;
+}
+
+bool processCommandLine(int argc, const char* argv[], BenchmarkOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const std::string_view parm(argv[i]);
+        if (i + 1 >= argc) {
+            std::cerr << "***Error*** No value after " << parm << endl;
+            return false;
+        }
+        const char* value = argv[++i];
+        if (parm == "--years")
+            options.data.years = atoi(value);
+        else if (parm == "--bar-minutes")
+            options.data.bar_minutes = atoi(value);
+        else if (parm == "--seed")
+            options.data.seed = strtoull(value, nullptr, 10);
+        else if (parm == "--min-time")
+            options.min_seconds = atof(value);
+        else if (parm == "--dir")
+            options.directory = value;
+        else if (parm == "--json")
+            options.json_path = value;
+        else if (parm == "--filter")
+            options.filter = value;
+        else {
+            std::cerr << "***Error*** Unknown option " << parm << endl;
+            return false;
+        }
+    }
+    return options.data.years > 0 && options.data.bar_minutes > 0;
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+    BenchmarkOptions options;
+    options.data.years = 10;
+    options.data.bar_minutes = 5;
+    options.data.duplicate_rate = 0.0; // streaming and pipeline modes need ascending dates
+    if (!processCommandLine(argc, argv, options)) {
+        std::cerr << "resample_bench [--years N] [--bar-minutes N] [--seed N] [--min-time seconds] [--dir directory] [--json file] [--filter text]" << endl;
+        return -1;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(options.directory, ec);
+
+    // one symbol's file, in memory and on disk
+    const string text = generateStockData(options.data, 0);
+    const std::filesystem::path input_path = options.directory / "bench.csv";
+    const std::filesystem::path output_path = options.directory / "bench_resampled.csv";
+    std::ofstream(input_path, std::ios::binary).write(text.data(), text.size());
+
+    std::vector<std::string_view> lines;
+    const char* next = text.data();
+    const char* const end = next + text.size();
+    std::string_view line;
+    nextLine(next, end, line); // header
+    while (nextLine(next, end, line))
+        lines.push_back(line);
+    std::cerr << lines.size() << " lines, " << text.size() / (1024.0 * 1024.0) << " MB" << endl;
+
+    std::ostream null_log(nullptr); // messages are dropped
+    std::vector<Result> results;
+    auto run = [&](const string& name, uint64_t items, uint64_t bytes, const std::function<void()>& work) {
+        if (name.find(options.filter) != string::npos)
+            results.push_back(measure(options, name, items, bytes, work));
+    };
+
+    // parsing
+    std::vector<std::string_view> dates;
+    std::string_view fields[8];
+    for (std::string_view l : lines) {
+        splitView(l, ',', fields, 8);
+        dates.push_back(fields[0]);
+    }
+    const SimdLevel best_level = simdLevel();
+    for (SimdLevel level : { SimdLevel::scalar, SimdLevel::sse2, SimdLevel::avx2 }) {
+        if (!setSimdLevel(level))
+            continue;
+        run(string("splitView/") + simdLevelName(level), lines.size(), text.size(), [&] {
+            std::string_view f[8];
+            for (std::string_view l : lines)
+                sink += splitView(l, ',', f, 8) + f[7].size();
+        });
+    }
+    setSimdLevel(best_level);
+
+    // the minimum value filter: the four prices of every line
+    std::vector<std::string_view> line_fields;
+    for (std::string_view l : lines) {
+        splitView(l, ',', fields, 8);
+        line_fields.insert(line_fields.end(), fields, fields + 8);
+    }
+    run("atof", 4 * lines.size(), 0, [&] {
+        for (size_t i = 0; i < line_fields.size(); i += 8) {
+            for (int j = 2; j < 6; j++)
+                sink += atof(line_fields[i + j].data()) < 1.0;
+        }
+    });
+    run("parseDecimal", 4 * lines.size(), 0, [&] {
+        for (size_t i = 0; i < line_fields.size(); i += 8) {
+            for (int j = 2; j < 6; j++)
+                sink += parseDecimal(line_fields[i + j]) < 1.0;
+        }
+    });
+    for (bool check_sanity : { false, true }) {
+        run(check_sanity ? "checkBar/sanity" : "checkBar", lines.size(), 0, [&] {
+            for (size_t i = 0; i < line_fields.size(); i += 8)
+                sink += (int)checkBar(&line_fields[i], 1.0f, check_sanity);
+        });
+    }
+    run("DateStringToDayNumber", dates.size(), 0, [&] {
+        DateParser parser;
+        DayNumber day{ 0 };
+        for (size_t i = 0; i < dates.size(); i++) {
+            if (DateStringToDayNumber(lines[i], dates[i], parser, day, null_log))
+                sink += day;
+        }
+    });
+
+    // periods. days lines up with lines, so a date that doesn't parse can't just be left out
+    std::vector<DayNumber> days;
+    {
+        DateParser parser;
+        DayNumber day{ 0 };
+        for (std::string_view date : dates) {
+            if (!parser.parse(date, day)) {
+                std::cerr << "***Error*** Invalid date in generated data: " << date << endl;
+                return -1;
+            }
+            days.push_back(day);
+        }
+    }
+    run("weekNumber", days.size(), 0, [&] {
+        for (DayNumber day : days)
+            sink += weekNumber(day);
+    });
+    run("monthNumber", days.size(), 0, [&] {
+        for (DayNumber day : days)
+            sink += monthNumber(day);
+    });
+
+    // partitioning and writing, from bars kept as views of the generated text
+    BarStore bars;
+    bars.reserve(lines.size());
+    for (size_t i = 0; i < lines.size(); i++) {
+        splitView(lines[i], ',', fields, 8);
+        if (!bars.inDay() || days[i] != bars.currentDate()) {
+            bars.endDay();
+            bars.beginDay(days[i]);
+        }
+        const size_t values_size = fields[7].data() + fields[7].size() - fields[2].data();
+        bars.addBar(BarView(lines[i].data(), fields[0].size(), fields[1].size(), values_size));
+    }
+    bars.sortDays();
+    const std::vector<int> ratio{ 3, 2, 1 };
+    for (const char* interval_text : { "d", "5d", "w", "w-mon", "m", "q", "y" }) {
+        Interval interval;
+        parseInterval(interval_text, interval);
+        run(string("assignDatasets/") + interval_text, bars.days().size(), 0, [&] {
+            std::vector<uint32_t> dataset_days[3];
+            assignDatasets(bars.days(), interval, ratio, 0, dataset_days);
+            sink += dataset_days[2].size();
+        });
+    }
+
+    std::vector<uint32_t> dataset_days[3];
+    Interval weeks;
+    parseInterval("w", weeks);
+    assignDatasets(bars.days(), weeks, ratio, 0, dataset_days);
+    for (bool gather_writes : { false, true }) {
+        uint64_t bytes_written = 0;
+        auto write = [&] {
+            OutputWriter output_file(output_buffer_size, gather_writes);
+            output_file.open(output_path);
+            writeHeader(output_file);
+            DayNumber next_day = writeOutputFile(output_file, bars, dataset_days[0], bars.days().front().date, "training", null_log);
+            next_day = writeOutputFile(output_file, bars, dataset_days[1], next_day, "validation", null_log);
+            writeOutputFile(output_file, bars, dataset_days[2], next_day, "test", null_log);
+            output_file.close();
+            bytes_written = output_file.bytesWritten();
+        };
+        write();
+        run(gather_writes ? "writeOutputFile/writev" : "writeOutputFile", lines.size(), bytes_written, write);
+    }
+
+    // whole file, read from disk and written to disk, the ways ResampleStockData can do it
+    struct Mode {
+        string name;
+        std::function<void(Options&)> set;
+    };
+    const unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+    const Mode modes[] = {
+        { "mmap", [](Options&) {} },
+        { "mmap_p" + std::to_string(threads), [threads](Options& o) { o.parse_threads = threads; } },
+        { "streaming", [](Options& o) { o.streaming = true; } },
+        { "pipeline", [](Options& o) { o.pipeline = true; } },
+    };
+    for (const Mode& mode : modes) {
+        Options resample_options;
+        resample_options.interval = weeks;
+        resample_options.ratio = ratio;
+        resample_options.min_value = 1.0f;
+        mode.set(resample_options);
+        run("end_to_end/" + mode.name, lines.size(), text.size(), [&] {
+            OutputWriter output_file(output_buffer_size, resample_options.gather_writes);
+            output_file.open(output_path);
+            FileStats stats;
+            bool rc;
+            if (resample_options.streaming)
+                rc = ProcessCSVFileStreaming(resample_options, input_path, output_file, output_path, null_log, stats);
+            else if (resample_options.pipeline)
+                rc = ProcessCSVFilePipelined(resample_options, input_path, output_file, output_path, null_log, stats);
+            else
+                rc = ProcessMappedCSVFile(resample_options, input_path, output_file, null_log, stats);
+            sink += rc;
+        });
+    }
+
+    // the same file handed to a caller in process (ResampleLibrary.h): parsed and partitioned, with every bar of every
+    // data set visited, but nothing written
+    Options library_options;
+    library_options.interval = weeks;
+    library_options.ratio = ratio;
+    run("end_to_end/library", lines.size(), text.size(), [&] {
+        ParsedBars parsed;
+        Partitions partitions;
+        if (parsed.loadFile(library_options, input_path, null_log) && parsed.partition(library_options, partitions, null_log)) {
+            forEachDay(partitions, parsed.bars(), [&](DatasetAssigner::Dataset, const PartitionedDay& day, std::span<const BarView> day_bars) {
+                sink += day.new_date + day_bars.size();
+            });
+        }
+    });
+
+    std::filesystem::remove(input_path, ec);
+    std::filesystem::remove(output_path, ec);
+
+    if (options.json_path.empty())
+        writeJson(std::cout, options, lines.size(), text.size(), results);
+    else {
+        std::ofstream json_file(options.json_path);
+        writeJson(json_file, options, lines.size(), text.size(), results);
+        if (!json_file) {
+            std::cerr << "***Error*** Unable to write '" << options.json_path.string() << "'" << endl;
+            return -1;
+        }
+    }
+    std::cerr << "(checksum " << sink << ")" << endl;
+    return 0;
+}
@@ -0,0 +1,91 @@
+//
+// GenerateStockData.cpp : writes made up TradeStation format .csv files, for benchmarking ResampleStockData
+//
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "StockDataGenerator.h"
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+void usage() {
+    cout << "generate_stock_data -o directory [--symbols N] [--start-year YYYY] [--years N] [--bar-minutes N] [--seconds]" << endl
+         << "    [--plain-header] [--gap-rate R] [--duplicate-rate R] [--low-price-rate R] [--low-price P] [--seed N]" << endl;
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+    GeneratorConfig config;
+    std::filesystem::path directory;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view parm(argv[i]);
+        // options without a value
+        if (parm == "--seconds") {
+            config.seconds = true;
+            continue;
+        }
+        if (parm == "--plain-header") {
+            config.quoted_header = false;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            cout << "***Error*** No value after " << parm << endl;
+            usage();
+            return -1;
+        }
+        const char* value = argv[++i];
+        if (parm == "-o")
+            directory = value;
+        else if (parm == "--symbols")
+            config.symbols = atoi(value);
+        else if (parm == "--start-year")
+            config.start_year = atoi(value);
+        else if (parm == "--years")
+            config.years = atoi(value);
+        else if (parm == "--bar-minutes")
+            config.bar_minutes = atoi(value);
+        else if (parm == "--gap-rate")
+            config.gap_rate = atof(value);
+        else if (parm == "--duplicate-rate")
+            config.duplicate_rate = atof(value);
+        else if (parm == "--low-price-rate")
+            config.low_price_rate = atof(value);
+        else if (parm == "--low-price")
+            config.low_price = atof(value);
+        else if (parm == "--seed")
+            config.seed = strtoull(value, nullptr, 10);
+        else {
+            cout << "***Error*** Unknown option " << parm << endl;
+            usage();
+            return -1;
+        }
+    }
+    if (directory.empty() || config.symbols < 1 || config.years < 1 || config.bar_minutes < 1 || config.start_year < 1) {
+        usage();
+        return -1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    uint64_t total_bytes = 0;
+    for (int symbol = 0; symbol < config.symbols; symbol++) {
+        const std::string name = "sym" + std::to_string(symbol + 1) + "_" + std::to_string(config.bar_minutes) + "min.csv";
+        const std::string text = generateStockData(config, symbol);
+        std::ofstream file(directory / name, std::ios::binary);
+        if (!file.write(text.data(), text.size())) {
+            cout << "***Error*** Unable to write '" << (directory / name).string() << "'" << endl;
+            return -1;
+        }
+        total_bytes += text.size();
+    }
+    cout << "Wrote " << config.symbols << " files, " << total_bytes / (1024.0 * 1024.0) << " MB to '" << directory.string() << "'" << endl;
+    return 0;
+}
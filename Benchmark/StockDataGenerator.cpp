@@ -0,0 +1,96 @@
+//
+// StockDataGenerator.cpp : makes up TradeStation format stock data, for benchmarks
+//
+
+#include "StockDataGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "../ResampleStockData/CivilDate.h"
+
+namespace {
+
+// splitmix64; small, fast and the same everywhere
+class Random {
+public:
+    explicit Random(uint64_t seed) : state_(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    // in [0, 1)
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    // standard normal, by Box-Muller
+    double normal() {
+        const double u1 = 1.0 - uniform(); // (0, 1], for log
+        const double u2 = uniform();
+        return std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2);
+    }
+    bool chance(double rate) { return rate > 0 && uniform() < rate; }
+
+private:
+    uint64_t state_;
+};
+
+constexpr int session_open = 9 * 60 + 30; // minutes after midnight
+constexpr int session_close = 16 * 60;
+
+} // namespace
+
+std::string generateStockData(const GeneratorConfig& config, int symbol) {
+    Random random(config.seed * 1000003 + (uint64_t)symbol);
+    const int bar_minutes = std::max(1, config.bar_minutes);
+    const double volatility = 0.01 * std::sqrt(std::min(bar_minutes, session_close - session_open) / 390.0); // ~1% a day
+
+    std::string text = config.quoted_header ? "\"Date\",\"Time\",\"Open\",\"High\",\"Low\",\"Close\",\"Up\",\"Down\"\n"
+                                            : "Date,Time,Open,High,Low,Close,Up,Down\n";
+    std::string day_text, previous_day_text;
+    double price = config.start_price * (1.0 + 0.5 * random.uniform());
+    const DayNumber first_day = daysFromCivil(config.start_year, 1, 1);
+    const DayNumber end_day = daysFromCivil(config.start_year + config.years, 1, 1);
+    for (DayNumber day = first_day; day < end_day; day++) {
+        const int day_of_week = weekday(day);
+        if (day_of_week == 0 || day_of_week == 6 || random.chance(config.gap_rate))
+            continue;
+
+        char date[formatted_date_size + 1]{};
+        formatDate(day, date);
+        day_text.clear();
+        for (int bar_end = session_open + bar_minutes; ; bar_end += bar_minutes) {
+            bar_end = std::min(bar_end, session_close);
+
+            // random walk, kept well above any sensible minimum value unless a low price is asked for
+            const double open = price;
+            double close = open * std::exp(volatility * random.normal());
+            if (close < 2.0)
+                close = 2.0 + (2.0 - close);
+            const double high = std::max(open, close) * (1.0 + 0.25 * volatility * std::fabs(random.normal()));
+            double low = std::min(open, close) * (1.0 - 0.25 * volatility * std::fabs(random.normal()));
+            if (random.chance(config.low_price_rate))
+                low = config.low_price;
+            price = close;
+
+            char line[160];
+            const int size = config.seconds
+                ? snprintf(line, sizeof(line), "%s,%02d:%02d:00,%.2f,%.2f,%.2f,%.2f,%llu,%llu\n", date, bar_end / 60, bar_end % 60,
+                    open, high, low, close, (unsigned long long)(random.next() % 5000000), (unsigned long long)(random.next() % 5000000))
+                : snprintf(line, sizeof(line), "%s,%02d:%02d,%.2f,%.2f,%.2f,%.2f,%llu,%llu\n", date, bar_end / 60, bar_end % 60,
+                    open, high, low, close, (unsigned long long)(random.next() % 5000000), (unsigned long long)(random.next() % 5000000));
+            day_text.append(line, size);
+            if (bar_end == session_close)
+                break;
+        }
+        text += day_text;
+
+        // the day before, again
+        if (!previous_day_text.empty() && random.chance(config.duplicate_rate))
+            text += previous_day_text;
+        previous_day_text.swap(day_text);
+    }
+    return text;
+}
@@ -0,0 +1,28 @@
+//
+// StockDataGenerator.h : makes up TradeStation format stock data, for benchmarks
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// what to generate. Rates are per trading day (gaps, duplicate days) or per bar (low prices)
+struct GeneratorConfig {
+    int symbols{ 1 };
+    int start_year{ 2000 };
+    int years{ 10 };
+    int bar_minutes{ 60 };        // bars of a 09:30 - 16:00 session; 390 or more is one bar a day
+    bool seconds{ false };        // time as hh:mm:ss instead of hh:mm
+    bool quoted_header{ true };   // "Date","Time",... as TradeStation writes it, or Date,Time,...
+    double gap_rate{ 0.02 };      // trading days left out, besides weekends
+    double duplicate_rate{ 0.0 }; // days written a second time, after the next day, so their date comes up again
+    double low_price_rate{ 0.0 }; // bars with a low below low_price, which -m filters out with the rest of their day
+    double low_price{ 0.5 };
+    double start_price{ 50.0 };
+    uint64_t seed{ 1 };
+};
+
+// Returns the whole file for one symbol (0 to symbols - 1). The same config and symbol give the same text on every
+// platform: the random numbers don't come from <random>, whose distributions differ between standard libraries
+std::string generateStockData(const GeneratorConfig& config, int symbol);
@@ -0,0 +1,113 @@
+//
+// AllocationCounter.cpp : counts the program's allocations for --stats by replacing the global operator new
+//
+// Only the ResampleStockData executable is built with this file. A program that links resample_core keeps its own
+// operator new (and any allocator hooks it has), and its stats report allocations as unknown
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "Stats.h"
+
+namespace {
+
+// constant initialized, so allocations made before main (or before the registration below) are counted too
+std::atomic<uint64_t> allocation_count{ 0 };
+
+const bool registered = (countAllocationsWith(&allocation_count), true);
+
+void* allocate(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void* allocateAligned(size_t size, std::align_val_t alignment) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    const size_t align = (size_t)alignment;
+#ifdef _WIN32
+    return _aligned_malloc(size ? size : 1, align);
+#else
+    // aligned_alloc needs a size that's a multiple of the alignment
+    return std::aligned_alloc(align, ((size ? size : 1) + align - 1) / align * align);
+#endif
+}
+
+void freeAligned(void* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+} // namespace
+
+// every allocation is counted, which costs an atomic add; small next to the allocation itself
+void* operator new(size_t size) {
+    if (void* p = allocate(size))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+// over-aligned types (alignas bigger than the default); these must be freed by the matching aligned delete
+void* operator new(size_t size, std::align_val_t alignment) {
+    if (void* p = allocateAligned(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateAligned(size, alignment);
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateAligned(size, alignment);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+    freeAligned(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept {
+    freeAligned(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    freeAligned(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    freeAligned(p);
+}
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    freeAligned(p);
+}
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+    freeAligned(p);
+}
@@ -0,0 +1,237 @@
+//
+// BarAggregator.cpp : --bar-size, coarser bars made from the input bars of each day as they're parsed
+//
+
+#include "BarAggregator.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+
+#include "FieldScanner.h"
+
+namespace {
+
+constexpr int64_t powers_of_ten[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+    10000000000, 100000000000, 1000000000000, 10000000000000, 100000000000000, 1000000000000000 };
+constexpr int max_digits = 15;
+
+// hh:mm or hh:mm:ss (h or hh) from 00:00 to 24:00 as seconds since midnight; false if it isn't
+bool secondsOfDay(std::string_view time, int& seconds) {
+    const auto valid = [&seconds](unsigned hours, unsigned minutes, unsigned secs) {
+        seconds = (int)(hours * 3600 + minutes * 60 + secs);
+        return minutes < 60 && secs < 60 && seconds <= 24 * 3600;
+    };
+    // the usual hh:mm and hh:mm:ss first
+    const auto digit = [&](size_t i) { return (unsigned)(time[i] - '0'); };
+    if ((time.size() == 5 || (time.size() == 8 && time[5] == ':')) && time[2] == ':') {
+        const bool has_seconds = time.size() == 8;
+        const unsigned h1 = digit(0), h2 = digit(1), m1 = digit(3), m2 = digit(4);
+        const unsigned s1 = has_seconds ? digit(6) : 0, s2 = has_seconds ? digit(7) : 0;
+        if (h1 < 10 && h2 < 10 && m1 < 10 && m2 < 10 && s1 < 10 && s2 < 10)
+            return valid(h1 * 10 + h2, m1 * 10 + m2, s1 * 10 + s2);
+    }
+    int parts[3] = { 0, 0, 0 };
+    int num_parts = 0;
+    int digits = 0;
+    for (const char c : time) {
+        if (c >= '0' && c <= '9') {
+            if (++digits > 2)
+                return false;
+            parts[num_parts] = parts[num_parts] * 10 + (c - '0');
+        }
+        else if (c == ':' && digits > 0 && num_parts < 2) {
+            num_parts++;
+            digits = 0;
+        }
+        else
+            return false;
+    }
+    if (digits == 0 || num_parts == 0)
+        return false;
+    return valid(parts[0], parts[1], parts[2]);
+}
+
+int decimalsOf(std::string_view number) {
+    const size_t point = number.find('.');
+    return point == std::string_view::npos ? 0 : (int)(number.size() - point - 1);
+}
+
+// -123.45 as units -12345 and 2 decimals. False for anything else: exponents, +, more than max_digits digits
+bool plainDecimal(std::string_view text, int64_t& units, int& decimals) {
+    const char* p = text.data();
+    const char* const end = p + text.size();
+    const bool negative = p < end && *p == '-';
+    p += negative;
+    units = 0;
+    decimals = 0;
+    int digits = 0;
+    bool point = false;
+    for (; p < end; p++) {
+        if ((unsigned)(*p - '0') < 10) {
+            units = units * 10 + (*p - '0');
+            digits++;
+            decimals += point;
+        }
+        else if (*p == '.' && !point)
+            point = true;
+        else
+            return false;
+    }
+    if (digits == 0 || digits > max_digits)
+        return false;
+    if (negative)
+        units = -units;
+    return true;
+}
+
+} // namespace
+
+bool parseBarSize(std::string_view text, BarSize& bar_size) {
+    bar_size = BarSize();
+    if (text == "session") {
+        bar_size.session = true;
+        return true;
+    }
+    if (text.empty() || text.size() > 4 || text.find_first_not_of("0123456789") != std::string_view::npos)
+        return false;
+    int minutes = 0;
+    std::from_chars(text.data(), text.data() + text.size(), minutes);
+    if (minutes < 1 || minutes > 24 * 60)
+        return false;
+    bar_size.minutes = minutes;
+    return true;
+}
+
+void BarAggregator::Total::add(std::string_view text) {
+    int64_t text_units;
+    int text_decimals;
+    if (exact && plainDecimal(text, text_units, text_decimals)) {
+        // both in units of the finer decimal, unless that could overflow
+        const int64_t limit = powers_of_ten[max_digits] * 1000;
+        if (text_decimals > decimals && std::abs(units) < limit / powers_of_ten[text_decimals - decimals]) {
+            units *= powers_of_ten[text_decimals - decimals];
+            decimals = text_decimals;
+        }
+        if (text_decimals <= decimals && std::abs(text_units) < limit / powers_of_ten[decimals - text_decimals] && std::abs(units) < limit) {
+            units += text_units * powers_of_ten[decimals - text_decimals];
+            return;
+        }
+    }
+    if (exact) {
+        exact = false;
+        value = (double)units / (double)powers_of_ten[decimals];
+    }
+    value += parseDecimal(text);
+    decimals = std::max(decimals, decimalsOf(text));
+}
+
+std::string_view BarAggregator::Total::format(char (&buffer)[64]) const {
+    if (!exact)
+        return std::string_view(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, decimals).ptr - buffer);
+
+    // the digits, with at least one before the point, then the point moved in
+    char* p = buffer;
+    if (units < 0)
+        *p++ = '-';
+    char* const digits = p;
+    const uint64_t magnitude = units < 0 ? 0 - (uint64_t)units : (uint64_t)units;
+    p = std::to_chars(p, buffer + sizeof(buffer), magnitude).ptr;
+    const int num_digits = (int)(p - digits);
+    if (num_digits <= decimals) {
+        const int zeros = decimals + 1 - num_digits;
+        std::memmove(digits + zeros, digits, num_digits);
+        std::memset(digits, '0', zeros);
+        p += zeros;
+    }
+    if (decimals > 0) {
+        std::memmove(p - decimals + 1, p - decimals, decimals);
+        p[-decimals] = '.';
+        p++;
+    }
+    return std::string_view(buffer, p - buffer);
+}
+
+bool BarAggregator::add(const std::string_view* fields, const double (&prices)[4], bool& finished) {
+    int period = 0;
+    if (!bar_size_.session) {
+        int seconds;
+        if (!secondsOfDay(fields[1], seconds))
+            return false;
+        const int length = bar_size_.minutes * 60;
+        period = (seconds + length - 1) / length;
+    }
+    finished = building_ && (period != period_ || fields[0] != date_) && finish();
+
+    const double high = prices[1];
+    const double low = prices[2];
+    if (!building_) {
+        building_ = true;
+        period_ = period;
+        date_.assign(fields[0]);
+        open_.assign(fields[2]);
+        high_.assign(fields[3]);
+        low_.assign(fields[4]);
+        high_value_ = high;
+        low_value_ = low;
+        up_ = Total();
+        down_ = Total();
+    }
+    else {
+        if (high > high_value_) {
+            high_.assign(fields[3]);
+            high_value_ = high;
+        }
+        if (low < low_value_) {
+            low_.assign(fields[4]);
+            low_value_ = low;
+        }
+    }
+    if (bar_size_.session)
+        time_.assign(fields[1]);
+    close_.assign(fields[5]);
+    up_.add(fields[6]);
+    down_.add(fields[7]);
+    return true;
+}
+
+bool BarAggregator::finish() {
+    if (!building_)
+        return false;
+    building_ = false;
+
+    // an N minute bar's time is the end of its N minutes, hh:mm
+    char end_time[6];
+    std::string_view time = time_;
+    if (!bar_size_.session) {
+        const int minutes = period_ * bar_size_.minutes;
+        const int hours = minutes / 60;
+        end_time[0] = (char)('0' + hours / 10);
+        end_time[1] = (char)('0' + hours % 10);
+        end_time[2] = ':';
+        end_time[3] = (char)('0' + minutes % 60 / 10);
+        end_time[4] = (char)('0' + minutes % 10);
+        time = std::string_view(end_time, 5);
+    }
+
+    char up[64];
+    char down[64];
+    const std::string_view parts[8] = { date_, time, open_, high_, low_, close_, up_.format(up), down_.format(down) };
+    text_.clear();
+    size_t starts[8];
+    for (int i = 0; i < 8; i++) {
+        if (i > 0)
+            text_ += ',';
+        starts[i] = text_.size();
+        text_ += parts[i];
+    }
+    for (int i = 0; i < 8; i++)
+        fields_[i] = std::string_view(text_.data() + starts[i], parts[i].size());
+    return true;
+}
+
+BarView BarAggregator::copyTo(TextArena& arena) const {
+    const std::string_view text = arena.copy(text_);
+    return BarView(text.data(), fields_[0].size(), fields_[1].size(), text_.size() - fields_[0].size() - fields_[1].size() - 2);
+}
@@ -0,0 +1,72 @@
+//
+// BarAggregator.h : --bar-size, coarser bars made from the input bars of each day as they're parsed
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "BarStore.h"
+
+// the bars written: the input bars as they are, N minute bars or one bar per day
+struct BarSize {
+    int minutes{ 0 };      // 0 = as they are
+    bool session{ false }; // one bar per day
+
+    bool aggregating() const { return minutes > 0 || session; }
+};
+
+// N (minutes, 1 to 1440) or session. Returns false if text isn't one of them
+bool parseBarSize(std::string_view text, BarSize& bar_size);
+
+// Folds the bars of a file into bars of a BarSize as they go by, so the input bars are never kept. An N minute bar is
+// made of the input bars whose times are in the same N minutes counting from midnight, with TradeStation's convention
+// that a bar is stamped with the time it ends: 60 minute bars have the bars from 9:01 to 10:00 in the 10:00 bar, even
+// if there's no 10:00 input bar (the bar ending at midnight is 24:00). A session bar is stamped with the time of its
+// last bar. A bar has the open of its first bar, the highest high, the lowest low, the close of its last bar and the up
+// and down of all of them added up, and the date of its last bar. Prices are copied as they were written; up and down are
+// each written with as many decimals as the most precise of its values had
+class BarAggregator {
+public:
+    explicit BarAggregator(const BarSize& bar_size) : bar_size_(bar_size) {}
+
+    // folds in the next bar (fields: date, time, open, high, low, close, up, down; prices: open, high, low, close as
+    // checkBar parsed them). If it isn't part of the bar being built (it has another date, or is in other N minutes),
+    // that bar is finished first and finished is set. Returns false if the time isn't hh:mm or hh:mm:ss (up to 24:00)
+    bool add(const std::string_view* fields, const double (&prices)[4], bool& finished);
+    // finishes the bar being built, at the end of a day; false if there isn't one
+    bool finish();
+    // throws away the bar being built
+    void clear() { building_ = false; }
+
+    // the bar finished last: date, time, open, high, low, close, up, down. Valid until the next add or finish
+    const std::string_view* fields() const { return fields_; }
+    // same, as a view of a copy of its text in arena
+    BarView copyTo(TextArena& arena) const;
+
+private:
+    // up or down of the bars so far
+    struct Total {
+        int64_t units{ 0 };  // the total in units of its last decimal
+        int decimals{ 0 };
+        bool exact{ true };  // false once a value isn't a plain decimal (or units would overflow); then it's in value
+        double value{ 0 };
+
+        void add(std::string_view text);
+        std::string_view format(char (&buffer)[64]) const;
+    };
+
+    BarSize bar_size_;
+    bool building_{ false };
+    int period_{ 0 };        // # of the N minutes of the day the bar being built is in
+    std::string date_, time_, open_, high_, low_, close_; // time_ is only kept for session bars
+    double high_value_{ 0 };
+    double low_value_{ 0 };
+    Total up_;
+    Total down_;
+
+    std::string text_;       // finished bar
+    std::string_view fields_[8];
+};
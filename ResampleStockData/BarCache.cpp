@@ -0,0 +1,334 @@
+//
+// BarCache.cpp : binary cache of the parsed bars of an input file, so later runs over the same file skip parsing
+//
+// A .rsbin file holds every data line of the input file, before the minimum value filter and duplicate date handling
+// (which depend on the command line), in fixed width columns:
+//   CacheHeader
+//   double open[num_lines], high[num_lines], low[num_lines], close[num_lines]   as atof returned them
+//   CachedBar bars[num_lines]          where each bar's date,time,open,...,down text is in the text area
+//   CachedDay days[num_days]           day index: runs of lines with the same date, in file order
+//   char text[text_size]
+// Time, up and down are kept as text, since output files have to reproduce the input text exactly.
+// The cache is tied to the input file's size, modification time and a hash of its contents, and is rebuilt when any
+// of them changes
+//
+
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ResampleStockData.h"
+#include "LineHandler.h"
+#include "MappedFile.h"
+
+using std::endl;
+using std::string;
+
+namespace {
+
+constexpr char cache_magic[8] = { 'R', 'S', 'B', 'I', 'N', '\r', '\n', '\x1a' };
+constexpr uint32_t cache_version = 1;
+constexpr uint32_t byte_order_mark = 0x01020304; // a cache written on a machine with other byte order isn't used
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_hash;
+    uint64_t num_lines;
+    uint64_t num_days;
+    uint64_t text_size;
+    uint64_t last_line_offset; // last line of input file, for duplicate date message
+    uint32_t last_line_size;
+    uint32_t header_ok;        // first line was the expected header
+};
+
+struct CachedBar {
+    uint64_t text_offset;
+    uint16_t date_size;
+    uint16_t time_size;
+    uint32_t values_size;
+};
+
+struct CachedDay {
+    DayNumber date;
+    uint32_t first_line_size; // first line of day as it was in input file, for duplicate date message
+    uint64_t first_line_offset;
+    uint64_t first_bar;       // index in bars
+    uint64_t num_bars;
+};
+
+static_assert(sizeof(CacheHeader) % 8 == 0 && sizeof(CachedBar) % 8 == 0 && sizeof(CachedDay) % 8 == 0);
+
+// the columns of a cache, whether mapped from a .rsbin file or just built
+struct CacheView {
+    const CacheHeader* header{ nullptr };
+    const double* open{ nullptr };
+    const double* high{ nullptr };
+    const double* low{ nullptr };
+    const double* close{ nullptr };
+    const CachedBar* bars{ nullptr };
+    const CachedDay* days{ nullptr };
+    const char* text{ nullptr };
+};
+
+// columns of a cache being built
+struct CacheColumns {
+    CacheHeader header{};
+    std::vector<double> open, high, low, close;
+    std::vector<CachedBar> bars;
+    std::vector<CachedDay> days;
+    string text;
+
+    CacheView view() const {
+        return CacheView{ &header, open.data(), high.data(), low.data(), close.data(), bars.data(), days.data(), text.data() };
+    }
+};
+
+size_t columnsSize(uint64_t num_lines, uint64_t num_days) {
+    return sizeof(CacheHeader) + 4 * num_lines * sizeof(double) + num_lines * sizeof(CachedBar) + num_days * sizeof(CachedDay);
+}
+
+// checks mapped cache file against the input file; fills in view if it can be used
+bool openCache(const MappedFile& cache_file, const MappedFile& input_file, int64_t input_mtime, CacheView& view) {
+    if (cache_file.size() < sizeof(CacheHeader))
+        return false;
+    const CacheHeader* header = (const CacheHeader*)cache_file.data();
+    if (memcmp(header->magic, cache_magic, sizeof(cache_magic)) != 0 || header->version != cache_version || header->byte_order != byte_order_mark)
+        return false;
+    if (header->source_size != input_file.size() || header->source_mtime != input_mtime)
+        return false;
+    if (header->num_lines > cache_file.size() || header->num_days > cache_file.size() ||
+        columnsSize(header->num_lines, header->num_days) + header->text_size != cache_file.size())
+        return false;
+    if (header->source_hash != hashBytes(input_file.data(), input_file.size()))
+        return false;
+
+    const char* next = cache_file.data() + sizeof(CacheHeader);
+    auto column = [&next](size_t size) {
+        const char* column_data = next;
+        next += size;
+        return column_data;
+    };
+    view.header = header;
+    view.open = (const double*)column(header->num_lines * sizeof(double));
+    view.high = (const double*)column(header->num_lines * sizeof(double));
+    view.low = (const double*)column(header->num_lines * sizeof(double));
+    view.close = (const double*)column(header->num_lines * sizeof(double));
+    view.bars = (const CachedBar*)column(header->num_lines * sizeof(CachedBar));
+    view.days = (const CachedDay*)column(header->num_days * sizeof(CachedDay));
+    view.text = column(header->text_size);
+    return true;
+}
+
+// parses mapped input file into cache columns. Returns false if input file has an invalid line (or no lines at all)
+bool buildCache(const MappedFile& input_file, int64_t input_mtime, CacheColumns& cache) {
+    const char* next = input_file.data();
+    const char* const end = next + input_file.size();
+    std::string_view line;
+    if (!nextLine(next, end, line))
+        return false;
+
+    CacheHeader& header = cache.header;
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.byte_order = byte_order_mark;
+    header.source_size = input_file.size();
+    header.source_mtime = input_mtime;
+    header.source_hash = hashBytes(input_file.data(), input_file.size());
+    header.header_ok = line == "\"Date\",\"Time\",\"Open\",\"High\",\"Low\",\"Close\",\"Up\",\"Down\"" || line == "Date,Time,Open,High,Low,Close,Up,Down";
+    cache.text.reserve(input_file.size());
+
+    std::string_view fields[8];
+    DayNumber t;
+    DateParser date_parser;
+    while (nextLine(next, end, line))
+    {
+        if (splitView(line, ',', fields, 8) != 8 || !date_parser.parse(fields[0], t))
+            return false;
+        size_t values_size = 5; // 5 separating commas
+        for (int i = 2; i < 8; i++)
+            values_size += fields[i].size();
+        if (!BarView::fits(fields[0].size(), fields[1].size(), values_size))
+            return false;
+
+        // new date, start a new day
+        if (cache.days.empty() || cache.days.back().date != t) {
+            cache.days.push_back(CachedDay{ t, (uint32_t)line.size(), cache.text.size(), cache.bars.size(), 0 });
+            cache.text += line;
+        }
+        cache.days.back().num_bars++;
+
+        cache.open.push_back(parseDecimal(fields[2]));
+        cache.high.push_back(parseDecimal(fields[3]));
+        cache.low.push_back(parseDecimal(fields[4]));
+        cache.close.push_back(parseDecimal(fields[5]));
+
+        // date,time,open,...,down with single commas (splitView skips empty fields)
+        cache.bars.push_back(CachedBar{ cache.text.size(), (uint16_t)fields[0].size(), (uint16_t)fields[1].size(), (uint32_t)values_size });
+        for (int i = 0; i < 8; i++) {
+            if (i > 0)
+                cache.text += ',';
+            cache.text += fields[i];
+        }
+    }
+    if (cache.bars.empty())
+        return false;
+
+    header.last_line_offset = cache.text.size();
+    header.last_line_size = (uint32_t)line.size();
+    cache.text += line;
+    header.num_lines = cache.bars.size();
+    header.num_days = cache.days.size();
+    header.text_size = cache.text.size();
+    return true;
+}
+
+// writes cache to a temporary file which then replaces cache_path, so a cache file is never seen half written
+bool writeCache(const CacheColumns& cache, const std::filesystem::path& cache_path) {
+    std::filesystem::path temp_path = cache_path;
+    temp_path += ".tmp";
+    OutputWriter cache_file;
+    if (!cache_file.open(temp_path))
+        return false;
+    auto writeColumn = [&cache_file](const void* data, size_t size) { cache_file.write(std::string_view((const char*)data, size)); };
+    writeColumn(&cache.header, sizeof(cache.header));
+    writeColumn(cache.open.data(), cache.open.size() * sizeof(double));
+    writeColumn(cache.high.data(), cache.high.size() * sizeof(double));
+    writeColumn(cache.low.data(), cache.low.size() * sizeof(double));
+    writeColumn(cache.close.data(), cache.close.size() * sizeof(double));
+    writeColumn(cache.bars.data(), cache.bars.size() * sizeof(CachedBar));
+    writeColumn(cache.days.data(), cache.days.size() * sizeof(CachedDay));
+    writeColumn(cache.text.data(), cache.text.size());
+
+    std::error_code ec;
+    if (!cache_file.close()) {
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    std::filesystem::rename(temp_path, cache_path, ec);
+    if (ec) {
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+// does what ProcessCSVFile does with the lines of the input file, using the cached columns instead of parsing
+bool resampleFromCache(const Options& options, const CacheView& cache, OutputWriter& output_file, std::ostream& log, FileStats& stats) {
+    const CacheHeader& header = *cache.header;
+    if (!header.header_ok)
+        log << "***Warning*** First line is not expected header:" << "Date,Time,Open,High,Low,Close,Up,Down" << endl;
+    writeHeader(output_file, options.warmup_bars > 0);
+
+    const auto parse_start = std::chrono::steady_clock::now();
+    SampledTimer filter_timer;
+    BarStore bars;
+    bars.reserve(header.num_lines);
+    // days start and end, and bars are dropped, as LineHandler does for lines; only the minimum value test is the cache's
+    LineHandler handler(options, stats, log);
+    TextArena no_text; // bars are views of the cache, so none are copied
+    StoredBars stored_bars(bars, no_text, log);
+    const DayNumber initial_day = cache.days[0].date;
+    for (uint64_t d = 0; d < header.num_days; d++) {
+        const CachedDay& day = cache.days[d];
+        uint64_t first_bar = day.first_bar;
+        stats.lines += day.num_bars;
+
+        // a cached day is a run of lines with the same date, so each one is a new day
+        bool skip_line;
+        handler.newDay(day.date, std::string_view(cache.text + day.first_line_offset, day.first_line_size), stored_bars, skip_line);
+        if (skip_line)
+            first_bar++;
+
+        for (uint64_t i = first_bar; i < day.first_bar + day.num_bars; i++) {
+            // check open, high, low, close for minimum value
+            filter_timer.start();
+            const bool min_found = cache.open[i] < options.min_value || cache.high[i] < options.min_value || cache.low[i] < options.min_value ||
+                cache.close[i] < options.min_value;
+            filter_timer.stop(stats.filter_seconds);
+            if (!handler.filter(min_found ? BarCheck::below_min : BarCheck::ok, std::string_view(), stored_bars))
+                continue;
+            const CachedBar& bar = cache.bars[i];
+            bars.addBar(BarView(cache.text + bar.text_offset, bar.date_size, bar.time_size, bar.values_size));
+        }
+    }
+
+    // save last day
+    handler.finish(std::string_view(cache.text + header.last_line_offset, header.last_line_size), stored_bars);
+    stats.parse_seconds += secondsSince(parse_start);
+
+    return ResampleBars(options, bars, initial_day, output_file, log, stats);
+}
+
+} // namespace
+
+// 64 bit hash of a block of memory, a word at a time. Not cryptographic; it's there to notice that a file has changed
+uint64_t hashBytes(const char* data, size_t size) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 29;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    hash = (hash ^ tail) * 0xC4CEB9FE1A85EC53ull;
+    return hash ^ (hash >> 32);
+}
+
+int64_t modificationTime(const std::filesystem::path& path) {
+    std::error_code ec;
+    const auto time = std::filesystem::last_write_time(path, ec);
+    return ec ? 0 : (int64_t)time.time_since_epoch().count();
+}
+
+bool ProcessCachedCSVFile(const Options& options, const std::filesystem::path& input_path, const std::filesystem::path& cache_path,
+    OutputWriter& output_file, std::ostream& log, FileStats& stats) {
+    const auto open_start = std::chrono::steady_clock::now();
+    MappedFile input_file;
+    if (!input_file.open(input_path)) {
+        log << "***Error*** Unable to open '" << input_path << "' for reading." << endl;
+        return false;
+    }
+    const int64_t input_mtime = modificationTime(input_path);
+
+    // use cache file if it's there and up to date
+    MappedFile cache_file;
+    CacheView cache;
+    if (cache_file.open(cache_path) && openCache(cache_file, input_file, input_mtime, cache)) {
+        stats.open_seconds += secondsSince(open_start);
+        stats.bytes_read += cache_file.size();
+        log << "Using cache '" << cache_path.filename().string() << "'" << endl;
+        return resampleFromCache(options, cache, output_file, log, stats);
+    }
+    cache_file.close();
+    stats.open_seconds += secondsSince(open_start);
+
+    // otherwise parse input file and save the result for next time. A file with an invalid line isn't cached; it's
+    // processed the usual way, which reports the problem
+    const auto build_start = std::chrono::steady_clock::now();
+    CacheColumns columns;
+    if (!buildCache(input_file, input_mtime, columns)) {
+        std::error_code ec;
+        std::filesystem::remove(cache_path, ec); // out of date
+        input_file.close();
+        return ProcessMappedCSVFile(options, input_path, output_file, log, stats);
+    }
+    stats.parse_seconds += secondsSince(build_start); // parsing the file to build the cache
+    if (writeCache(columns, cache_path)) {
+        char seconds[30];
+        snprintf(seconds, sizeof(seconds), "%.3f", std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count());
+        log << "Created cache '" << cache_path.filename().string() << "' in " << seconds << " seconds" << endl;
+    }
+    else
+        log << "***Warning*** Unable to write cache '" << cache_path.string() << "'" << endl;
+    return resampleFromCache(options, columns.view(), output_file, log, stats);
+}
@@ -0,0 +1,97 @@
+//
+// BarStore.cpp : all bars of a file in one array, with each day a range of it
+//
+
+#include "BarStore.h"
+
+#include <algorithm>
+#include <cstring>
+
+char* TextArena::allocate(size_t size) {
+    if (size > left_) {
+        // text bigger than a block gets a block of its own
+        const size_t new_block_size = std::max(size, block_size_);
+        blocks_.push_back(std::make_unique<char[]>(new_block_size));
+        next_ = blocks_.back().get();
+        left_ = new_block_size;
+    }
+    char* text = next_;
+    next_ += size;
+    left_ -= size;
+    return text;
+}
+
+std::string_view TextArena::copy(std::string_view text) {
+    char* copied = allocate(text.size());
+    memcpy(copied, text.data(), text.size());
+    return std::string_view(copied, text.size());
+}
+
+bool BarStore::endDay() {
+    if (!inDay())
+        return true;
+
+    const Day& day = days_.back();
+    if (day.num_bars == 0) {
+        days_.pop_back();
+        return true;
+    }
+
+    // look for an earlier day with the same date. Usually dates go up, so it's enough to look at the previous day;
+    // otherwise the dates seen so far are looked up
+    bool duplicate;
+    if (closed_days_ == 0)
+        duplicate = false;
+    else if (ascending_ && day.date >= days_[closed_days_ - 1].date)
+        duplicate = day.date == days_[closed_days_ - 1].date;
+    else {
+        if (seen_.empty()) {
+            for (size_t i = 0; i < closed_days_; i++)
+                markSeen(days_[i].date);
+        }
+        duplicate = seen(day.date);
+        if (!duplicate)
+            ascending_ = false;
+    }
+
+    if (duplicate) {
+        bars_.resize(day.first_bar);
+        days_.pop_back();
+        return false;
+    }
+    if (!seen_.empty())
+        markSeen(day.date);
+    closed_days_++;
+    return true;
+}
+
+void BarStore::markSeen(DayNumber date) {
+    if (seen_.empty()) {
+        seen_first_ = date;
+        seen_.resize(1);
+    }
+    // grown by at least its size, so days in descending order don't copy it over and over
+    if (date < seen_first_) {
+        const size_t extra = std::max<size_t>((size_t)(seen_first_ - date), seen_.size());
+        seen_.insert(seen_.begin(), extra, false);
+        seen_first_ -= (DayNumber)extra;
+    }
+    else if ((size_t)(date - seen_first_) >= seen_.size())
+        seen_.resize(std::max<size_t>((size_t)(date - seen_first_) + 1, seen_.size() * 2));
+    seen_[date - seen_first_] = true;
+}
+
+void BarStore::sortDays() {
+    endDay();
+    if (!ascending_)
+        std::sort(days_.begin(), days_.end(), [](const Day& a, const Day& b) { return a.date < b.date; });
+}
+
+void BarStore::truncateDays(size_t num_days) {
+    if (num_days >= days_.size())
+        return;
+    bars_.resize(days_[num_days].first_bar);
+    days_.resize(num_days);
+    closed_days_ = std::min(closed_days_, num_days);
+    seen_.clear(); // made again from the days left when it's needed
+}
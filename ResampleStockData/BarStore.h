@@ -0,0 +1,116 @@
+//
+// BarStore.h : all bars of a file in one array, with each day a range of it
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "CivilDate.h"
+
+// one bar of an input file: a view of the text "date,time,open,high,low,close,up,down" (with single commas) in the
+// memory mapped file or in a TextArena. Bars are kept by the million, so this is 16 bytes rather than three views
+class BarView {
+public:
+    BarView() = default;
+    BarView(const char* text, size_t date_size, size_t time_size, size_t values_size)
+        : text_(text), date_size_((uint16_t)date_size), time_size_((uint16_t)time_size), values_size_((uint32_t)values_size) {}
+
+    std::string_view date() const { return std::string_view(text_, date_size_); }     // original date, written as last field of output line
+    std::string_view time() const { return std::string_view(text_ + date_size_ + 1, time_size_); } // hh:mm or hh:mm:ss
+    std::string_view values() const { return std::string_view(text_ + date_size_ + 1 + time_size_ + 1, values_size_); } // Open,High,Low,Close,Up,Down
+    // time and values, with the comma between them
+    std::string_view timeAndValues() const { return std::string_view(text_ + date_size_ + 1, time_size_ + 1 + values_size_); }
+
+    // true if the field sizes fit
+    static bool fits(size_t date_size, size_t time_size, size_t values_size) {
+        return date_size <= UINT16_MAX && time_size <= UINT16_MAX && values_size <= UINT32_MAX;
+    }
+
+private:
+    const char* text_{ nullptr };
+    uint16_t date_size_{ 0 };
+    uint16_t time_size_{ 0 };
+    uint32_t values_size_{ 0 };
+};
+
+// storage for text which must stay where it is while views of it are used. Text is copied into large blocks, so
+// there's one allocation per block rather than one per string
+class TextArena {
+public:
+    explicit TextArena(size_t block_size = 1024 * 1024) : block_size_(block_size) {}
+
+    // returns room for size characters, valid as long as the arena
+    char* allocate(size_t size);
+    std::string_view copy(std::string_view text);
+
+    size_t blockCount() const { return blocks_.size(); }
+
+private:
+    size_t block_size_;
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* next_{ nullptr };
+    size_t left_{ 0 };
+};
+
+// Bars are added a day at a time, in file order: beginDay, addBar for each bar, endDay. Like a map keyed by date, the
+// store keeps only the first day with a given date; endDay throws away a later day with the same date. Once all days
+// are in, sortDays puts them in date order
+class BarStore {
+public:
+    struct Day {
+        DayNumber date;
+        uint32_t first_bar; // index in bars()
+        uint32_t num_bars;
+    };
+
+    void reserve(size_t num_bars) { bars_.reserve(num_bars); }
+
+    void beginDay(DayNumber date) { days_.push_back(Day{ date, (uint32_t)bars_.size(), 0 }); }
+    void addBar(const BarView& bar) {
+        bars_.push_back(bar);
+        days_.back().num_bars++;
+    }
+    // throws away all bars added to current day so far
+    void clearDay() {
+        bars_.resize(days_.back().first_bar);
+        days_.back().num_bars = 0;
+    }
+    bool inDay() const { return !days_.empty() && days_.size() > closed_days_; }
+    DayNumber currentDate() const { return days_.back().date; }
+    // finishes current day. A day with no bars is dropped. Returns false if the store already has a day with this date,
+    // in which case the current day is dropped too
+    bool endDay();
+
+    // puts days in date order. Cheap if they were added in date order, as they usually are
+    void sortDays();
+    // true if the days were added in date order, so sortDays left them in the order they were added
+    bool ascending() const { return ascending_; }
+    // keeps the first num_days days (in the order they were added) and their bars, so more days can be added after
+    // them. Days must not have been reordered by sortDays
+    void truncateDays(size_t num_days);
+
+    bool empty() const { return days_.empty(); }
+    const std::vector<Day>& days() const { return days_; }
+    std::span<const BarView> bars(const Day& day) const { return std::span<const BarView>(bars_.data() + day.first_bar, day.num_bars); }
+    // all of them, in the order they were added
+    std::span<const BarView> bars() const { return bars_; }
+    size_t barCount() const { return bars_.size(); }
+
+private:
+    std::vector<BarView> bars_;
+    std::vector<Day> days_;
+    size_t closed_days_{ 0 };
+    bool ascending_{ true }; // days_ (as closed so far) are in increasing date order
+
+    // the dates of the closed days, as bits from seen_first_ on, so a duplicate is found at once when days aren't in
+    // date order. Only made the first time a day's date isn't after the previous one's
+    void markSeen(DayNumber date);
+    bool seen(DayNumber date) const { return date >= seen_first_ && (size_t)(date - seen_first_) < seen_.size() && seen_[date - seen_first_]; }
+    std::vector<bool> seen_;
+    DayNumber seen_first_{ 0 };
+};
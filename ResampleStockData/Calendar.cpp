@@ -0,0 +1,106 @@
+//
+// Calendar.cpp : intervals (-i) and the periods they group days into
+//
+
+#include "Calendar.h"
+
+namespace {
+
+const char* const weekday_names[7] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+
+// rounds down, for days before 1970
+int floorDiv(int a, int b) {
+    return a >= 0 ? a / b : (a - b + 1) / b;
+}
+
+} // namespace
+
+std::string Interval::text() const {
+    switch (kind) {
+    case days: return length == 1 ? "d" : std::to_string(length) + "d";
+    case weeks: return week_start == 0 ? "w" : std::string("w-") + weekday_names[week_start];
+    case months: return "m";
+    case quarters: return "q";
+    default: return "y";
+    }
+}
+
+bool parseInterval(std::string_view text, Interval& interval) {
+    interval = Interval{};
+    if (text == "m" || text == "q" || text == "y") {
+        interval.kind = text == "m" ? Interval::months : text == "q" ? Interval::quarters : Interval::years;
+        return true;
+    }
+    if (text == "w")
+        interval.kind = Interval::weeks;
+    if (text.size() == 5 && text.starts_with("w-")) {
+        for (int i = 0; i < 7; i++) {
+            if (text.substr(2) == weekday_names[i]) {
+                interval.kind = Interval::weeks;
+                interval.week_start = i;
+            }
+        }
+    }
+    if (interval.kind == Interval::weeks)
+        return true;
+
+    // d or Nd
+    if (text.empty() || text.back() != 'd')
+        return false;
+    const std::string_view number = text.substr(0, text.size() - 1);
+    if (number.empty())
+        return true;
+    if (number.size() > 3 || number.find_first_not_of("0123456789") != std::string_view::npos || number[0] == '0')
+        return false;
+    interval.length = std::stoi(std::string(number));
+    return true;
+}
+
+int periodNumber(const Interval& interval, DayNumber day) {
+    switch (interval.kind) {
+    case Interval::weeks:
+        // Jan 1, 1970 was a Thursday, so its week started 4 - week_start days earlier (mod 7)
+        return floorDiv(day + (4 - interval.week_start + 7) % 7, 7);
+    case Interval::months:
+    case Interval::quarters:
+    case Interval::years: {
+        const CivilDate date = civilFromDays(day);
+        const int month = (date.year - 1970) * 12 + (int)date.month - 1;
+        return interval.kind == Interval::months ? month : interval.kind == Interval::quarters ? floorDiv(month, 3) : date.year - 1970;
+    }
+    default:
+        return 0;
+    }
+}
+
+CalendarIndex::CalendarIndex(const Interval& interval, DayNumber first, DayNumber last) : first_(first) {
+    if (last < first)
+        return;
+    periods_.resize((size_t)(last - first) + 1);
+    if (interval.kind == Interval::days)
+        return; // all 0; days periods don't come from the calendar
+
+    // start from first day's period and date, then move on a day at a time
+    int period = periodNumber(interval, first);
+    CivilDate date = civilFromDays(first);
+    int day_of_week = weekday(first);
+    for (size_t i = 0; i < periods_.size(); i++) {
+        periods_[i] = period;
+
+        if (++day_of_week == 7)
+            day_of_week = 0;
+        if (++date.day > daysInMonth(date.year, date.month)) {
+            date.day = 1;
+            if (++date.month > 12) {
+                date.month = 1;
+                date.year++;
+            }
+        }
+        switch (interval.kind) {
+        case Interval::weeks: period += day_of_week == interval.week_start; break;
+        case Interval::months: period += date.day == 1; break;
+        case Interval::quarters: period += date.day == 1 && date.month % 3 == 1; break;
+        default: period += date.day == 1 && date.month == 1; break;
+        }
+    }
+}
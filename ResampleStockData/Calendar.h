@@ -0,0 +1,42 @@
+//
+// Calendar.h : intervals (-i) and the periods they group days into
+//
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CivilDate.h"
+
+// how days are grouped into the periods that are dealt out to the data sets
+struct Interval {
+    enum Kind { days, weeks, months, quarters, years };
+    Kind kind{ days };
+    int length{ 1 };     // days: # of days with bars in a period (trading days, not calendar days)
+    int week_start{ 0 }; // weeks: day a week starts on, 0 = Sunday ... 6 = Saturday
+
+    bool operator==(const Interval&) const = default;
+    // as on the command line: d, 5d, w, w-mon, m, q or y
+    std::string text() const;
+};
+
+// d, Nd (N trading days, 1 to 999), w, w-sun ... w-sat, m, q or y. Returns false if text isn't one of them
+bool parseInterval(std::string_view text, Interval& interval);
+
+// # of the week, month, quarter or year day is in, counting from the one Jan 1, 1970 is in. Not for days intervals,
+// whose periods depend on which days have bars
+int periodNumber(const Interval& interval, DayNumber day);
+
+// The period number of every day from first to last, worked out in one walk through the calendar (a day at a time, so
+// there are no divisions), so finding a day's period is a lookup
+class CalendarIndex {
+public:
+    CalendarIndex(const Interval& interval, DayNumber first, DayNumber last);
+    int period(DayNumber day) const { return periods_[day - first_]; }
+
+private:
+    DayNumber first_;
+    std::vector<int> periods_;
+};
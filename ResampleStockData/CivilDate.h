@@ -0,0 +1,133 @@
+//
+// CivilDate.h : conversion between mm/dd/yyyy dates and day numbers, with no dependence on locale or time zone
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// # of days since Jan 1, 1970 (which is day 0). Negative for earlier dates
+using DayNumber = int32_t;
+
+struct CivilDate {
+    int year;
+    unsigned month; // 1..12
+    unsigned day;   // 1..31
+};
+
+constexpr bool isLeapYear(int year) {
+    return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+constexpr unsigned daysInMonth(int year, unsigned month) {
+    constexpr unsigned days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    return month == 2 && isLeapYear(year) ? 29 : days[month - 1];
+}
+
+// day number of given date in the proleptic Gregorian calendar. Counts from March 1, so the leap day is the last day
+// of the "year" and 400 year eras all have the same number of days (see Howard Hinnant's chrono-Compatible
+// Low-Level Date Algorithms)
+constexpr DayNumber daysFromCivil(int year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned year_of_era = (unsigned)(year - era * 400);                              // [0, 399]
+    const unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1; // [0, 365]
+    const unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year; // [0, 146096]
+    return era * 146097 + (DayNumber)day_of_era - 719468;
+}
+
+// inverse of daysFromCivil
+constexpr CivilDate civilFromDays(DayNumber day_number) {
+    const int z = day_number + 719468;
+    const int era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned day_of_era = (unsigned)(z - era * 146097);
+    const unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const unsigned mp = (5 * day_of_year + 2) / 153; // month, counting from March = 0
+    const unsigned day = day_of_year - (153 * mp + 2) / 5 + 1;
+    const unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    return CivilDate{ (int)year_of_era + era * 400 + (month <= 2), month, day };
+}
+
+// 0 = Sunday, 6 = Saturday
+constexpr int weekday(DayNumber day_number) {
+    return ((day_number + 4) % 7 + 7) % 7;
+}
+
+static_assert(daysFromCivil(1970, 1, 1) == 0);
+static_assert(daysFromCivil(2000, 3, 1) == 11017);
+static_assert(civilFromDays(11016).month == 2 && civilFromDays(11016).day == 29);
+static_assert(civilFromDays(-1).year == 1969 && civilFromDays(-1).day == 31);
+static_assert(weekday(0) == 4 && weekday(-4) == 0 && weekday(-5) == 6); // Jan 1 1970 was a Thursday
+
+// converts mm/dd/yyyy (month and day may also be a single digit) to a day number. Returns false if the text isn't
+// exactly a valid date
+constexpr bool parseDate(std::string_view text, DayNumber& day_number) {
+    size_t pos = 0;
+    auto number = [&text, &pos](size_t min_digits, size_t max_digits, unsigned& value) {
+        size_t digits = 0;
+        value = 0;
+        while (pos < text.size() && digits < max_digits && text[pos] >= '0' && text[pos] <= '9') {
+            value = value * 10 + (unsigned)(text[pos++] - '0');
+            digits++;
+        }
+        return digits >= min_digits;
+    };
+
+    unsigned month, day, year;
+    if (!number(1, 2, month) || pos >= text.size() || text[pos++] != '/')
+        return false;
+    if (!number(1, 2, day) || pos >= text.size() || text[pos++] != '/')
+        return false;
+    if (!number(4, 4, year) || pos != text.size())
+        return false;
+    if (month < 1 || month > 12 || day < 1 || day > daysInMonth((int)year, month) || year < 1)
+        return false;
+
+    day_number = daysFromCivil((int)year, month, day);
+    return true;
+}
+
+static_assert([] { DayNumber d = 0; return parseDate("02/29/2000", d) && d == 11016; }());
+static_assert([] { DayNumber d = 0; return !parseDate("02/29/1900", d) && !parseDate("13/01/2000", d) && !parseDate("1/1/200", d) && !parseDate("01/01/2000x", d); }());
+
+// writes day number as mm/dd/yyyy into buffer, which must have room for 10 characters. Not null terminated
+constexpr void formatDate(DayNumber day_number, char* buffer) {
+    const CivilDate date = civilFromDays(day_number);
+    buffer[0] = (char)('0' + date.month / 10);
+    buffer[1] = (char)('0' + date.month % 10);
+    buffer[2] = '/';
+    buffer[3] = (char)('0' + date.day / 10);
+    buffer[4] = (char)('0' + date.day % 10);
+    buffer[5] = '/';
+    buffer[6] = (char)('0' + date.year / 1000 % 10);
+    buffer[7] = (char)('0' + date.year / 100 % 10);
+    buffer[8] = (char)('0' + date.year / 10 % 10);
+    buffer[9] = (char)('0' + date.year % 10);
+}
+constexpr size_t formatted_date_size = 10;
+
+// parseDate, for a sequence of dates which mostly repeat the previous date (as the bars of a day do): if the text is
+// the same as last time, the previous day number is returned without parsing
+class DateParser {
+public:
+    bool parse(std::string_view text, DayNumber& day_number) {
+        if (text.size() == last_size_ && memcmp(text.data(), last_text_, last_size_) == 0) {
+            day_number = last_day_number_;
+            return true;
+        }
+        if (text.size() > sizeof(last_text_) || !parseDate(text, day_number))
+            return false;
+        memcpy(last_text_, text.data(), text.size());
+        last_size_ = text.size();
+        last_day_number_ = day_number;
+        return true;
+    }
+
+private:
+    char last_text_[10]{};
+    size_t last_size_{ 0 };
+    DayNumber last_day_number_{ 0 };
+};
@@ -0,0 +1,428 @@
+//
+// Compression.cpp : gzip and zstd input files, read through a decompression thread, and compressed output files
+//
+// The decompression thread reads the compressed file 1 MB at a time and decompresses it into 1 MB blocks, which go to
+// the reader through a queue; used blocks come back through another, so there are never more than a few in memory.
+// gzip files may be several gzip members one after the other (as cat a.gz b.gz makes), and zstd files several frames.
+// RESAMPLE_HAVE_ZLIB and RESAMPLE_HAVE_ZSTD (set by CMakeLists.txt when it finds the libraries) build each one in.
+//
+
+#include "Compression.h"
+#include "SpscQueue.h"
+#include "Stats.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#ifdef RESAMPLE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef RESAMPLE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+constexpr size_t block_size = 1024 * 1024;
+constexpr size_t num_blocks = 4; // blocks being decompressed into, read, or waiting for either
+constexpr size_t read_size = 1024 * 1024;
+
+constexpr int gzip_level = 1; // fastest; text compresses well even so
+constexpr int zstd_level = 3; // zstd's default
+
+bool endsWith(const std::string& text, std::string_view suffix) {
+    return text.size() >= suffix.size() && std::string_view(text).substr(text.size() - suffix.size()) == suffix;
+}
+
+} // namespace
+
+Compression compressionOf(const std::filesystem::path& path) {
+    const std::string name = path.filename().string();
+    if (endsWith(name, ".gz"))
+        return Compression::gzip;
+    if (endsWith(name, ".zst"))
+        return Compression::zstd;
+    return Compression::none;
+}
+
+bool compressionSupported(Compression compression) {
+    switch (compression) {
+#ifdef RESAMPLE_HAVE_ZLIB
+    case Compression::gzip: return true;
+#endif
+#ifdef RESAMPLE_HAVE_ZSTD
+    case Compression::zstd: return true;
+#endif
+    case Compression::none: return true;
+    default: return false;
+    }
+}
+
+const char* compressionName(Compression compression) {
+    switch (compression) {
+    case Compression::gzip: return "gzip";
+    case Compression::zstd: return "zstd";
+    default: return "none";
+    }
+}
+
+const char* compressionExtension(Compression compression) {
+    switch (compression) {
+    case Compression::gzip: return ".gz";
+    case Compression::zstd: return ".zst";
+    default: return "";
+    }
+}
+
+bool isCsvFile(const std::filesystem::path& path) {
+    const std::string name = path.filename().string();
+    return endsWith(name, ".csv") || endsWith(name, ".csv.gz") || endsWith(name, ".csv.zst");
+}
+
+std::string csvStem(const std::filesystem::path& path) {
+    std::string name = path.filename().string();
+    name.resize(name.size() - strlen(compressionExtension(compressionOf(path))));
+    if (endsWith(name, ".csv"))
+        name.resize(name.size() - 4);
+    return name;
+}
+
+//
+// Compressor
+//
+
+struct Compressor::State {
+#ifdef RESAMPLE_HAVE_ZLIB
+    z_stream gzip{};
+#endif
+#ifdef RESAMPLE_HAVE_ZSTD
+    ZSTD_CStream* zstd{ nullptr };
+#endif
+};
+
+Compressor::Compressor(Compression compression) : compression_(compression), state_(std::make_unique<State>()) {
+#ifdef RESAMPLE_HAVE_ZLIB
+    // 15 + 16: gzip header and trailer rather than zlib's
+    if (compression == Compression::gzip)
+        ok_ = deflateInit2(&state_->gzip, gzip_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+#endif
+#ifdef RESAMPLE_HAVE_ZSTD
+    if (compression == Compression::zstd) {
+        state_->zstd = ZSTD_createCStream();
+        ok_ = state_->zstd != nullptr && !ZSTD_isError(ZSTD_initCStream(state_->zstd, zstd_level));
+    }
+#endif
+}
+
+Compressor::~Compressor() {
+#ifdef RESAMPLE_HAVE_ZLIB
+    if (compression_ == Compression::gzip && ok_)
+        deflateEnd(&state_->gzip);
+#endif
+#ifdef RESAMPLE_HAVE_ZSTD
+    if (state_->zstd != nullptr)
+        ZSTD_freeCStream(state_->zstd);
+#endif
+}
+
+bool Compressor::compress(std::string_view text, bool finish, std::string_view& compressed) {
+    if (!ok_)
+        return false;
+    // out_ grows until it holds what one call produces; about the size of the output buffer at most
+    size_t used = 0;
+    auto makeRoom = [&] {
+        if (out_.size() - used < 64 * 1024)
+            out_.resize(out_.size() + 256 * 1024);
+    };
+
+#ifdef RESAMPLE_HAVE_ZLIB
+    if (compression_ == Compression::gzip) {
+        z_stream& stream = state_->gzip;
+        stream.next_in = (Bytef*)text.data();
+        stream.avail_in = (uInt)text.size();
+        while (true) {
+            makeRoom();
+            stream.next_out = (Bytef*)out_.data() + used;
+            stream.avail_out = (uInt)(out_.size() - used);
+            const int rc = deflate(&stream, finish ? Z_FINISH : Z_NO_FLUSH);
+            used = out_.size() - stream.avail_out;
+            if (rc == Z_STREAM_ERROR)
+                return false;
+            // done when all input is in and deflate didn't run out of room (so has nothing more to give yet)
+            if (finish ? rc == Z_STREAM_END : stream.avail_in == 0 && stream.avail_out != 0)
+                break;
+        }
+    }
+#endif
+#ifdef RESAMPLE_HAVE_ZSTD
+    if (compression_ == Compression::zstd) {
+        ZSTD_inBuffer in{ text.data(), text.size(), 0 };
+        while (true) {
+            makeRoom();
+            ZSTD_outBuffer out{ out_.data() + used, out_.size() - used, 0 };
+            const size_t left = ZSTD_compressStream2(state_->zstd, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+            used += out.pos;
+            if (ZSTD_isError(left))
+                return false;
+            if (finish ? left == 0 : in.pos == in.size)
+                break;
+        }
+    }
+#endif
+
+    compressed = std::string_view(out_.data(), used);
+    return true;
+}
+
+//
+// DecompressingStream
+//
+
+class DecompressingStream::Buffer : public std::streambuf {
+public:
+    Buffer(std::ifstream&& file, Compression compression) : file_(std::move(file)), compression_(compression), input_(read_size) {
+        for (size_t i = 0; i < num_blocks; i++)
+            free_.push(Block{ std::make_unique<char[]>(block_size), 0 });
+        thread_ = std::thread([this] { run(); });
+    }
+    ~Buffer() { stop(); }
+
+    void stop() {
+        if (!thread_.joinable())
+            return;
+        full_.close(); // in case the reader stopped before the end
+        free_.close();
+        thread_.join();
+    }
+
+    std::string error;
+    uint64_t compressed_bytes{ 0 };
+    uint64_t decompressed_bytes{ 0 };
+    double busy_seconds{ 0 };
+    double waitingSeconds() const { return full_.consumerWaitSeconds(); }
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        if (block_.data != nullptr)
+            free_.push(std::move(block_));
+        if (!full_.pop(block_))
+            return traits_type::eof();
+        setg(block_.data.get(), block_.data.get(), block_.data.get() + block_.size);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size{ 0 };
+    };
+
+    void run() {
+        const auto start = std::chrono::steady_clock::now();
+        Block block;
+        if (free_.pop(block)) {
+            // hands block on to the reader and gets an empty one; false if the reader has gone
+            auto passOn = [&] {
+                decompressed_bytes += block.size;
+                if (!full_.push(std::move(block)) || !free_.pop(block))
+                    return false;
+                block.size = 0;
+                return true;
+            };
+            if (compression_ == Compression::gzip)
+                inflateFile(block, passOn);
+            else
+                decompressZstdFile(block, passOn);
+            // after an error, stop at the end of the last whole line, so it's the error that's reported, not a cut off line
+            if (!error.empty()) {
+                while (block.size > 0 && block.data[block.size - 1] != '\n')
+                    block.size--;
+            }
+            if (block.size > 0)
+                passOn();
+        }
+        full_.close();
+        busy_seconds = secondsSince(start) - free_.consumerWaitSeconds() - full_.producerWaitSeconds();
+    }
+
+    // reads the next piece of the compressed file into input_; returns its size, 0 at the end (or on a read error)
+    size_t readInput() {
+        file_.read(input_.data(), (std::streamsize)input_.size());
+        const size_t size = (size_t)file_.gcount();
+        compressed_bytes += size;
+        if (file_.bad() && error.empty())
+            error = "read error";
+        return size;
+    }
+
+    template <typename PassOn>
+    void inflateFile(Block& block, PassOn& passOn) {
+#ifdef RESAMPLE_HAVE_ZLIB
+        z_stream stream{};
+        // 15 + 32: gzip (or zlib) header, whichever it is
+        if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+            error = "unable to start zlib";
+            return;
+        }
+        auto refill = [&] {
+            stream.next_in = (Bytef*)input_.data();
+            stream.avail_in = (uInt)readInput();
+            return stream.avail_in > 0;
+        };
+        bool member_ended = false;
+        bool output_full = false;
+        while (true) {
+            if (member_ended) {
+                // another gzip member may follow
+                if (stream.avail_in == 0 && !refill())
+                    break;
+                inflateReset(&stream);
+                member_ended = false;
+            }
+            // with a full block, inflate may have more to give without more input
+            else if (stream.avail_in == 0 && !output_full && !refill()) {
+                if (error.empty())
+                    error = "unexpected end of file";
+                break;
+            }
+            stream.next_out = (Bytef*)block.data.get() + block.size;
+            stream.avail_out = (uInt)(block_size - block.size);
+            const int rc = inflate(&stream, Z_NO_FLUSH);
+            block.size = block_size - stream.avail_out;
+            if (rc == Z_STREAM_END)
+                member_ended = true;
+            else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                error = stream.msg != nullptr ? stream.msg : "corrupt data";
+                break;
+            }
+            output_full = stream.avail_out == 0;
+            if (output_full && !passOn())
+                break;
+        }
+        inflateEnd(&stream);
+#else
+        (void)block;
+        (void)passOn;
+        error = "this build can't read gzip files";
+#endif
+    }
+
+    template <typename PassOn>
+    void decompressZstdFile(Block& block, PassOn& passOn) {
+#ifdef RESAMPLE_HAVE_ZSTD
+        ZSTD_DStream* stream = ZSTD_createDStream();
+        if (stream == nullptr || ZSTD_isError(ZSTD_initDStream(stream))) {
+            ZSTD_freeDStream(stream);
+            error = "unable to start zstd";
+            return;
+        }
+        ZSTD_inBuffer in{ input_.data(), 0, 0 };
+        size_t frame_left = 0; // 0 between frames
+        bool output_full = false;
+        while (true) {
+            // with a full block, zstd may have more to give without more input
+            if (in.pos == in.size && !output_full) {
+                in = ZSTD_inBuffer{ input_.data(), readInput(), 0 };
+                if (in.size == 0) {
+                    if (frame_left != 0 && error.empty())
+                        error = "unexpected end of file";
+                    break;
+                }
+            }
+            ZSTD_outBuffer out{ block.data.get() + block.size, block_size - block.size, 0 };
+            frame_left = ZSTD_decompressStream(stream, &out, &in);
+            if (ZSTD_isError(frame_left)) {
+                error = ZSTD_getErrorName(frame_left);
+                break;
+            }
+            block.size += out.pos;
+            output_full = out.pos == out.size;
+            if (output_full && !passOn())
+                break;
+        }
+        ZSTD_freeDStream(stream);
+#else
+        (void)block;
+        (void)passOn;
+        error = "this build can't read zstd files";
+#endif
+    }
+
+    std::ifstream file_;
+    Compression compression_;
+    std::vector<char> input_;
+    SpscQueue<Block> free_{ num_blocks };
+    SpscQueue<Block> full_{ num_blocks };
+    Block block_; // being read
+    std::thread thread_;
+};
+
+DecompressingStream::DecompressingStream() : std::istream(nullptr) {}
+
+DecompressingStream::~DecompressingStream() {
+    close();
+}
+
+bool DecompressingStream::open(const std::filesystem::path& path, Compression compression) {
+    close();
+    if (compression == Compression::none || !compressionSupported(compression))
+        return false;
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    buffer_ = std::make_unique<Buffer>(std::move(file), compression);
+    rdbuf(buffer_.get());
+    clear();
+    return true;
+}
+
+void DecompressingStream::close() {
+    if (buffer_ != nullptr)
+        buffer_->stop();
+}
+
+const std::string& DecompressingStream::error() const {
+    static const std::string no_error;
+    return buffer_ != nullptr ? buffer_->error : no_error;
+}
+
+uint64_t DecompressingStream::compressedBytes() const {
+    return buffer_ != nullptr ? buffer_->compressed_bytes : 0;
+}
+
+uint64_t DecompressingStream::decompressedBytes() const {
+    return buffer_ != nullptr ? buffer_->decompressed_bytes : 0;
+}
+
+double DecompressingStream::busySeconds() const {
+    return buffer_ != nullptr ? buffer_->busy_seconds : 0;
+}
+
+double DecompressingStream::waitingSeconds() const {
+    return buffer_ != nullptr ? buffer_->waitingSeconds() : 0;
+}
+
+bool inputStreamOk(const std::istream& input, std::ostream& log) {
+    if (const DecompressingStream* compressed = dynamic_cast<const DecompressingStream*>(&input); compressed != nullptr && !compressed->error().empty()) {
+        log << "***Error*** Unable to decompress input file: " << compressed->error() << std::endl;
+        return false;
+    }
+    if (input.bad()) {
+        log << "***Error*** Unable to read input file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void logDecompression(DecompressingStream& input, std::ostream& log) {
+    input.close();
+    char message[200];
+    snprintf(message, sizeof(message), "Decompressed %.1f MB from %.1f MB in %.3f seconds on its own thread; waited %.3f seconds for it",
+        input.decompressedBytes() / (1024.0 * 1024.0), input.compressedBytes() / (1024.0 * 1024.0), input.busySeconds(), input.waitingSeconds());
+    log << message << std::endl;
+}
@@ -0,0 +1,79 @@
+//
+// Compression.h : gzip and zstd input files, read through a decompression thread, and compressed output files
+//
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// how a file is compressed, going by its name: name.csv.gz, name.csv.zst or (anything else) not at all
+enum class Compression { none, gzip, zstd };
+
+Compression compressionOf(const std::filesystem::path& path);
+// false if this build can't read or write it. The gzip and zstd code is only built in where zlib and zstd were found
+bool compressionSupported(Compression compression);
+const char* compressionName(Compression compression);
+// what's added to the name of a file compressed this way: .gz, .zst or nothing
+const char* compressionExtension(Compression compression);
+
+// name.csv, name.csv.gz or name.csv.zst
+bool isCsvFile(const std::filesystem::path& path);
+// file name without .csv, .csv.gz or .csv.zst
+std::string csvStem(const std::filesystem::path& path);
+
+// compresses a stream of text a piece at a time, for OutputWriter
+class Compressor {
+public:
+    explicit Compressor(Compression compression);
+    ~Compressor();
+    Compressor(const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+
+    // false if the library couldn't be set up
+    bool ok() const { return ok_; }
+    // compresses text (finish also ends the stream) and returns what's ready in compressed, valid until the next call
+    bool compress(std::string_view text, bool finish, std::string_view& compressed);
+
+private:
+    struct State;
+    Compression compression_;
+    std::unique_ptr<State> state_;
+    std::vector<char> out_;
+    bool ok_{ false };
+};
+
+// A compressed file read as a stream of its text. The file is read and decompressed on a thread of its own, a few
+// blocks ahead of whoever reads the stream, so decompressing overlaps parsing. If the file turns out to be corrupt or
+// cut short, the stream ends there and error() says why
+class DecompressingStream : public std::istream {
+public:
+    DecompressingStream();
+    ~DecompressingStream();
+
+    // false if path can't be opened or this build can't decompress it
+    bool open(const std::filesystem::path& path, Compression compression);
+    // stops the thread; the numbers below are final after this
+    void close();
+
+    const std::string& error() const;
+    uint64_t compressedBytes() const;
+    uint64_t decompressedBytes() const;
+    double busySeconds() const;   // decompression thread, not counting the time it waited for the reader
+    double waitingSeconds() const; // reader, waiting for the decompression thread
+
+private:
+    class Buffer;
+    std::unique_ptr<Buffer> buffer_;
+};
+
+// false, with a message, if input stopped early because it couldn't be read or decompressed
+bool inputStreamOk(const std::istream& input, std::ostream& log);
+// closes input and says how big it was and how long decompressing it took
+void logDecompression(DecompressingStream& input, std::ostream& log);
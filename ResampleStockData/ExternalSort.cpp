@@ -0,0 +1,507 @@
+//
+// ExternalSort.cpp : resamples input whose lines aren't in date order, or that is split into part files (--sort)
+//
+// The lines of every part are read into a buffer of at most --sort-memory MB, sorted by date and time, and written to
+// a run file next to the output file whenever the buffer is full. The runs are then merged (k-way, through a small
+// buffer for each run) into one stream of bars in date and time order, which is sent to the data sets a day at a time
+// as in streaming mode. If there are too many runs to give each a buffer within the memory limit, groups of them are
+// merged into longer runs first. Input that fits in the buffer is sorted there and never written to a run file.
+// A line that is an exact copy of an earlier line with the same date and time is dropped during the merge.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <queue>
+
+#include "ResampleStockData.h"
+#include "LineHandler.h"
+#include "MappedFile.h"
+
+using std::endl;
+using std::string;
+
+namespace {
+
+// smallest read buffer a run gets while merging; with more runs than fit, some are merged into one first
+constexpr size_t min_run_buffer = 64 * 1024;
+constexpr size_t run_write_buffer = 256 * 1024;
+
+// how each line is kept in a run file: this, followed by the line
+struct RunRecord {
+    DayNumber date;
+    uint32_t time; // seconds since midnight
+    uint32_t length;
+};
+
+// a line in the sort buffer
+struct SortKey {
+    DayNumber date;
+    uint32_t time;
+    uint32_t length;
+    uint64_t offset; // of the line in the buffer; also keeps lines with the same date and time in input order
+
+    bool operator<(const SortKey& other) const {
+        if (date != other.date)
+            return date < other.date;
+        if (time != other.time)
+            return time < other.time;
+        return offset < other.offset;
+    }
+};
+
+// hh:mm or hh:mm:ss as seconds since midnight
+bool parseTime(std::string_view time, uint32_t& seconds) {
+    std::string_view parts[4];
+    const size_t num_parts = splitView(time, ':', parts, 4);
+    if (num_parts < 2 || num_parts > 3 || time.front() == ':' || time.back() == ':' || time.find("::") != std::string_view::npos)
+        return false;
+    seconds = 0;
+    for (size_t i = 0; i < 3; i++) {
+        uint32_t value = 0;
+        if (i < num_parts) {
+            if (parts[i].size() > 2 || parts[i].find_first_not_of("0123456789") != std::string_view::npos)
+                return false;
+            for (char c : parts[i])
+                value = value * 10 + (c - '0');
+        }
+        seconds = seconds * 60 + value;
+    }
+    return true;
+}
+
+// the lines of an input file without their \r, from a memory mapping or with std::getline (--io; compressed files are
+// always read with std::getline, from a DecompressingStream)
+class LineReader {
+public:
+    bool open(const std::filesystem::path& path, IOMode io_mode) {
+        io_mode_ = io_mode;
+        compression_ = compressionOf(path);
+        if (compression_ != Compression::none) {
+            io_mode_ = IOMode::stream;
+            stream_ = &compressed_;
+            return compressed_.open(path, compression_);
+        }
+        if (io_mode == IOMode::mmap) {
+            if (!mapped_.open(path))
+                return false;
+            next_ = mapped_.data();
+            end_ = next_ + mapped_.size();
+            return true;
+        }
+        file_.open(path);
+        return file_.is_open() && file_.good();
+    }
+    bool next(std::string_view& line) {
+        if (io_mode_ == IOMode::mmap)
+            return nextLine(next_, end_, line);
+        if (!std::getline(*stream_, line_))
+            return false;
+        line = line_;
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        return true;
+    }
+    // after the last line: false, with a message, if the file couldn't all be read
+    bool finish(std::ostream& log) {
+        if (io_mode_ == IOMode::mmap)
+            return true;
+        if (!inputStreamOk(*stream_, log))
+            return false;
+        if (compression_ != Compression::none)
+            logDecompression(compressed_, log);
+        return true;
+    }
+
+private:
+    IOMode io_mode_{ IOMode::mmap };
+    Compression compression_{ Compression::none };
+    MappedFile mapped_;
+    const char* next_{ nullptr };
+    const char* end_{ nullptr };
+    std::ifstream file_;
+    DecompressingStream compressed_;
+    std::istream* stream_{ &file_ };
+    string line_;
+};
+
+// what reading the next record of a run found
+enum class RunRead { record, end, failed };
+
+// reads a run file back a record at a time
+class RunReader {
+public:
+    bool open(const std::filesystem::path& path, size_t buffer_size) {
+        buffer_.resize(buffer_size);
+        file_.rdbuf()->pubsetbuf(buffer_.data(), (std::streamsize)buffer_.size()); // before open, or it's ignored
+        file_.open(path, std::ios::binary);
+        return file_.is_open();
+    }
+    // moves on to the next record. The run has only ended if the file ends right after a whole record; a file that
+    // ends partway through one, or can't be read, has failed
+    RunRead next() {
+        if (!file_.read((char*)&record_, sizeof(record_)))
+            return file_.eof() && file_.gcount() == 0 ? RunRead::end : RunRead::failed;
+        text_.resize(record_.length);
+        return file_.read(text_.data(), record_.length) ? RunRead::record : RunRead::failed;
+    }
+    const RunRecord& record() const { return record_; }
+    std::string_view text() const { return text_; }
+
+private:
+    std::vector<char> buffer_;
+    std::ifstream file_;
+    RunRecord record_{};
+    string text_;
+};
+
+void writeRecord(OutputWriter& run_file, const RunRecord& record, std::string_view text) {
+    run_file.write(std::string_view((const char*)&record, sizeof(record)));
+    run_file.write(text);
+}
+
+// Sorts lines by date and time within memory_limit bytes, spilling sorted runs to files next to the output file
+class ExternalSorter {
+public:
+    // input_size (of all parts) keeps the buffer small for small files
+    ExternalSorter(size_t memory_limit, uint64_t input_size, const std::filesystem::path& output_path)
+        : memory_limit_(memory_limit), output_path_(output_path) {
+        // about 50 bytes of text to 24 of key per line; a line (8 fields, 7 commas and a line end) is at least 16 bytes
+        text_capacity_ = (size_t)std::min<uint64_t>(memory_limit / 3 * 2, input_size + 1);
+        key_capacity_ = (size_t)std::min<uint64_t>(memory_limit / 3 / sizeof(SortKey), input_size / 16 + 1);
+        text_.reserve(text_capacity_);
+        keys_.reserve(key_capacity_);
+    }
+    ~ExternalSorter() { removeRuns(); }
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+    // adds a line; writes a run first if the buffer is full. False if the run can't be written
+    bool add(DayNumber date, uint32_t time, std::string_view line, std::ostream& log) {
+        if (!keys_.empty() && (text_.size() + line.size() > text_capacity_ || keys_.size() == key_capacity_) && !writeRun(log))
+            return false;
+        keys_.push_back(SortKey{ date, time, (uint32_t)line.size(), text_.size() });
+        text_ += line;
+        return true;
+    }
+
+    // calls emit(date, line) for each line in date and time order, lines with the same date and time in input order.
+    // An exact copy of an earlier line with the same date and time is counted in duplicates instead
+    template<typename Emit>
+    bool merge(Emit emit, uint64_t& duplicates, std::ostream& log) {
+        const auto sort_start = std::chrono::steady_clock::now();
+        DuplicateFilter filter(duplicates);
+        if (runs_.empty()) {
+            std::sort(keys_.begin(), keys_.end());
+            sort_seconds_ += secondsSince(sort_start);
+            for (const SortKey& key : keys_) {
+                const std::string_view line(text_.data() + key.offset, key.length);
+                if (filter.keep(key.date, key.time, line))
+                    emit(key.date, line);
+            }
+            return true;
+        }
+
+        // the rest of the lines are a run too, and then the buffer isn't needed any more
+        if (!keys_.empty() && !writeRun(log))
+            return false;
+        string().swap(text_);
+        std::vector<SortKey>().swap(keys_);
+        initial_runs_ = runs_.size();
+
+        // too many runs to merge at once: merge each group of max_runs runs into one, in order (so lines with the same
+        // date and time stay in input order), until there are few enough
+        const size_t max_runs = std::max<size_t>(2, (memory_limit_ - run_write_buffer) / min_run_buffer);
+        while (runs_.size() > max_runs) {
+            std::vector<std::filesystem::path> merged_runs;
+            for (size_t first = 0; first < runs_.size(); first += max_runs) {
+                const std::vector<std::filesystem::path> group(runs_.begin() + first, runs_.begin() + std::min(first + max_runs, runs_.size()));
+                if (group.size() == 1) {
+                    merged_runs.push_back(group.front());
+                    continue;
+                }
+                const std::filesystem::path merged_path = runPath();
+                merged_runs.push_back(merged_path);
+                OutputWriter run_file(run_write_buffer);
+                const bool opened = run_file.open(merged_path);
+                const bool read = opened && mergeRuns(group, (memory_limit_ - run_write_buffer) / group.size(), log,
+                    [&](const RunRecord& record, std::string_view text) { writeRecord(run_file, record, text); });
+                const bool written = run_file.close() && opened;
+                removeFiles(group);
+                if (!read || !written) {
+                    // mergeRuns has said why it couldn't read a run
+                    if (!written)
+                        log << "***Error*** Unable to write '" << merged_path.string() << "'. The disk might be full." << endl;
+                    removeFiles(merged_runs);
+                    return false;
+                }
+            }
+            runs_.swap(merged_runs);
+            merge_passes_++;
+        }
+        sort_seconds_ += secondsSince(sort_start);
+
+        return mergeRuns(runs_, std::min<size_t>(memory_limit_ / runs_.size(), 4 * 1024 * 1024), log, [&](const RunRecord& record, std::string_view text) {
+            if (filter.keep(record.date, record.time, text))
+                emit(record.date, text);
+        });
+    }
+
+    size_t runCount() const { return initial_runs_; }
+    size_t mergePasses() const { return merge_passes_; }
+    double sortSeconds() const { return sort_seconds_; }
+
+private:
+    // drops a line that is the same as an earlier one with the same date and time. Lines come in date and time order,
+    // so only the lines of the current date and time are kept
+    class DuplicateFilter {
+    public:
+        explicit DuplicateFilter(uint64_t& duplicates) : duplicates_(duplicates) {}
+        bool keep(DayNumber date, uint32_t time, std::string_view line) {
+            if (num_lines_ == 0 || date != date_ || time != time_) {
+                date_ = date;
+                time_ = time;
+                num_lines_ = 0;
+            }
+            else if (std::find(lines_.begin(), lines_.begin() + num_lines_, line) != lines_.begin() + num_lines_) {
+                duplicates_++;
+                return false;
+            }
+            // strings are reused, so this doesn't allocate once they're long enough
+            if (num_lines_ == lines_.size())
+                lines_.emplace_back();
+            lines_[num_lines_++].assign(line);
+            return true;
+        }
+
+    private:
+        uint64_t& duplicates_;
+        DayNumber date_{ 0 };
+        uint32_t time_{ 0 };
+        std::vector<string> lines_;
+        size_t num_lines_{ 0 };
+    };
+
+    std::filesystem::path runPath() {
+        return output_path_.string() + "." + std::to_string(next_run_++) + ".run";
+    }
+
+    bool writeRun(std::ostream& log) {
+        const auto sort_start = std::chrono::steady_clock::now();
+        std::sort(keys_.begin(), keys_.end());
+        const std::filesystem::path path = runPath();
+        runs_.push_back(path);
+        OutputWriter run_file(run_write_buffer);
+        if (!run_file.open(path)) {
+            log << "***Error*** Unable to create '" << path.string() << "'" << endl;
+            return false;
+        }
+        for (const SortKey& key : keys_)
+            writeRecord(run_file, RunRecord{ key.date, key.time, key.length }, std::string_view(text_.data() + key.offset, key.length));
+        if (!run_file.close()) {
+            log << "***Error*** Unable to write '" << path.string() << "'. The disk might be full." << endl;
+            return false;
+        }
+        text_.clear();
+        keys_.clear();
+        sort_seconds_ += secondsSince(sort_start);
+        return true;
+    }
+
+    // k-way merge of runs, each read through a buffer of buffer_size; calls add(record, text) for each record. Records
+    // with the same date and time come from the earliest run first. False if a run can't be read back whole
+    template<typename Add>
+    static bool mergeRuns(const std::vector<std::filesystem::path>& runs, size_t buffer_size, std::ostream& log, Add add) {
+        std::vector<RunReader> readers(runs.size());
+        for (size_t i = 0; i < runs.size(); i++) {
+            if (!readers[i].open(runs[i], std::max(buffer_size, min_run_buffer))) {
+                log << "***Error*** Unable to read back '" << runs[i].string() << "'" << endl;
+                return false;
+            }
+        }
+        // smallest date and time (then run) on top
+        auto after = [&](size_t a, size_t b) {
+            const RunRecord& ra = readers[a].record();
+            const RunRecord& rb = readers[b].record();
+            if (ra.date != rb.date)
+                return ra.date > rb.date;
+            if (ra.time != rb.time)
+                return ra.time > rb.time;
+            return a > b;
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(after)> heap(after);
+        // reads run i's next record, which goes on the heap; false if the run is cut short, which would lose its bars
+        auto advance = [&](size_t i) {
+            const RunRead read = readers[i].next();
+            if (read == RunRead::record)
+                heap.push(i);
+            if (read != RunRead::failed)
+                return true;
+            log << "***Error*** Unable to read back '" << runs[i].string() << "'. The run file is incomplete." << endl;
+            return false;
+        };
+        for (size_t i = 0; i < readers.size(); i++) {
+            if (!advance(i))
+                return false;
+        }
+        while (!heap.empty()) {
+            const size_t i = heap.top();
+            heap.pop();
+            add(readers[i].record(), readers[i].text());
+            if (!advance(i))
+                return false;
+        }
+        return true;
+    }
+
+    static void removeFiles(const std::vector<std::filesystem::path>& paths) {
+        std::error_code ec;
+        for (const std::filesystem::path& path : paths)
+            std::filesystem::remove(path, ec);
+    }
+    void removeRuns() {
+        removeFiles(runs_);
+        runs_.clear();
+    }
+
+    size_t memory_limit_;
+    std::filesystem::path output_path_;
+    size_t text_capacity_;
+    size_t key_capacity_;
+    string text_;               // lines of the run being collected
+    std::vector<SortKey> keys_;
+    std::vector<std::filesystem::path> runs_; // in input order
+    size_t next_run_{ 0 };
+    size_t initial_runs_{ 0 };
+    size_t merge_passes_{ 0 };
+    double sort_seconds_{ 0 };
+};
+
+// name.partN.csv -> name (N is digits; any of them may also be .csv.gz or .csv.zst); anything else -> empty
+string partOf(const std::filesystem::path& path) {
+    const string stem = csvStem(path);
+    const size_t dot = stem.rfind(".part");
+    if (dot == string::npos || dot == 0 || dot + 5 == stem.size() || stem.find_first_not_of("0123456789", dot + 5) != string::npos)
+        return string();
+    return stem.substr(0, dot);
+}
+
+// part number of name.partN.csv; 0 for name.csv, so it comes first
+uint64_t partNumber(const std::filesystem::path& path) {
+    const string stem = csvStem(path);
+    return partOf(path).empty() ? 0 : std::stoull("0" + stem.substr(stem.rfind(".part") + 5).substr(0, 18));
+}
+
+} // namespace
+
+string inputStem(const std::filesystem::path& path) {
+    const string part_of = partOf(path);
+    return part_of.empty() ? csvStem(path) : part_of;
+}
+
+std::vector<std::filesystem::path> findParts(const std::filesystem::path& path) {
+    const string stem = inputStem(path);
+    std::vector<std::filesystem::path> parts;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(path.parent_path(), ec)) {
+        if (entry.is_regular_file() && isCsvFile(entry.path()) && inputStem(entry.path()) == stem)
+            parts.push_back(entry.path());
+    }
+    if (parts.empty())
+        parts.push_back(path);
+    std::sort(parts.begin(), parts.end(), [](const std::filesystem::path& a, const std::filesystem::path& b) {
+        return partNumber(a) != partNumber(b) ? partNumber(a) < partNumber(b) : a.filename() < b.filename();
+    });
+    return parts;
+}
+
+bool ProcessCSVFilesSorted(const Options& options, const std::vector<std::filesystem::path>& input_paths, OutputWriter& output_file,
+    const std::filesystem::path& output_path, std::ostream& log, FileStats& stats) {
+    uint64_t input_size = 0;
+    std::error_code ec;
+    for (const std::filesystem::path& path : input_paths)
+        input_size += std::filesystem::file_size(path, ec);
+    ExternalSorter sorter((size_t)options.sort_memory_mb * 1024 * 1024, input_size, output_path);
+
+    // read every part into sorted runs
+    const auto parse_start = std::chrono::steady_clock::now();
+    double open_seconds = 0;
+    LineHandler handler(options, stats, log);
+    std::string_view fields[8];
+    DayNumber t;
+    uint32_t time;
+    for (const std::filesystem::path& path : input_paths) {
+        const auto open_start = std::chrono::steady_clock::now();
+        LineReader reader;
+        if (!reader.open(path, options.io_mode)) {
+            log << "***Error*** Unable to open '" << path << "' for reading." << endl;
+            return false;
+        }
+        open_seconds += secondsSince(open_start);
+
+        // each part has its own header
+        std::string_view line;
+        if (!reader.next(line)) {
+            log << "***Error*** Input file is empty: '" << path.filename().string() << "'" << endl;
+            return false;
+        }
+        if (line != "\"Date\",\"Time\",\"Open\",\"High\",\"Low\",\"Close\",\"Up\",\"Down\"" && line != "Date,Time,Open,High,Low,Close,Up,Down")
+            log << "***Warning*** First line is not expected header:" << "Date,Time,Open,High,Low,Close,Up,Down" << endl;
+
+        while (reader.next(line)) {
+            stats.lines++;
+            if (!handler.parse(line, fields, t))
+                return false;
+            if (!parseTime(fields[1], time)) {
+                log << "***Error*** Invalid time: " << line << endl;
+                return false;
+            }
+            if (!sorter.add(t, time, line, log))
+                return false;
+        }
+        if (!reader.finish(log))
+            return false;
+    }
+    stats.open_seconds += open_seconds;
+
+    // write header to output file
+    writeHeader(output_file);
+
+    DatasetWriter dataset_writer(options, output_file, stats);
+    if (!dataset_writer.open(output_path, log))
+        return false;
+
+    // the merged lines are in date order, so each day is complete when the next one starts
+    const double written_before = stats.partition_seconds + stats.write_seconds;
+    DayBuffer bars_for_day;
+    bool writer_started = false;
+    DayBufferBars day_bars(bars_for_day, [&](DayNumber day, DayBuffer& bars) {
+        // training days are dated from the first date, even if that day had no bars
+        if (!writer_started) {
+            dataset_writer.start(handler.initialDay());
+            writer_started = true;
+        }
+        dataset_writer.write(day, bars);
+        return true;
+    });
+    bool lines_ok = true;
+    const bool merged = sorter.merge([&](DayNumber day, std::string_view line) {
+        splitView(line, ',', fields, 8);
+        if (lines_ok && !handler.handle(line, fields, day, day_bars))
+            lines_ok = false;
+    }, stats.duplicate_bars, log);
+    if (!merged || !lines_ok)
+        return false;
+    handler.finish(std::string_view(), day_bars);
+    stats.sort_seconds += sorter.sortSeconds();
+    stats.sort_runs += sorter.runCount();
+    stats.parse_seconds = secondsSince(parse_start) - open_seconds - sorter.sortSeconds() - (stats.partition_seconds + stats.write_seconds - written_before);
+
+    char message[200];
+    snprintf(message, sizeof(message), "Sorted %llu lines from %zu file(s) in %zu run(s) and %zu extra merge pass(es); dropped %llu duplicate bars",
+        (unsigned long long)stats.lines, input_paths.size(), std::max<size_t>(1, sorter.runCount()), sorter.mergePasses(),
+        (unsigned long long)stats.duplicate_bars);
+    log << message << endl;
+    return dataset_writer.finish(log);
+}
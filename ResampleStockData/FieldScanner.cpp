@@ -0,0 +1,284 @@
+//
+// FieldScanner.cpp : splits lines into fields and parses their prices, with SSE2 or AVX2 where the CPU has them
+//
+// splitView compares 16 (SSE2) or 32 (AVX2) bytes of the line with the delimiter at once, which gives a bit mask of
+// where the delimiters are; the fields are what's between the set bits. The last, partial block is loaded so it ends
+// at the end of the line (overlapping the block before it), so nothing past the line is read. Which version is used
+// is decided when the program starts, from what the CPU has.
+//
+
+#include "FieldScanner.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FIELD_SCANNER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// SSE2 is always there on x64, so the price compare doesn't need to be chosen at run time
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FIELD_SCANNER_SSE2
+#endif
+
+namespace {
+
+// turns delimiter positions into fields, skipping empty ones
+class FieldCollector {
+public:
+    FieldCollector(std::string_view line, std::string_view* fields, size_t max_fields)
+        : line_(line.data()), fields_(fields), max_fields_(max_fields) {}
+
+    // bit i of mask is set if line[block + i] is a delimiter
+    void addDelimiters(size_t block, uint32_t mask) {
+        while (mask != 0) {
+            endField(block + std::countr_zero(mask));
+            mask &= mask - 1;
+        }
+    }
+    // returns # of fields
+    size_t finish(size_t line_size) {
+        endField(line_size);
+        return num_fields_;
+    }
+
+private:
+    void endField(size_t pos) {
+        if (pos > field_start_) {
+            if (num_fields_ < max_fields_)
+                fields_[num_fields_] = std::string_view(line_ + field_start_, pos - field_start_);
+            num_fields_++;
+        }
+        field_start_ = pos + 1;
+    }
+
+    const char* line_;
+    std::string_view* fields_;
+    size_t max_fields_;
+    size_t num_fields_{ 0 };
+    size_t field_start_{ 0 };
+};
+
+size_t splitViewScalar(std::string_view line, char delimiter, std::string_view* fields, size_t max_fields) {
+    size_t num_fields = 0;
+    size_t pos = 0;
+    while (pos < line.size()) {
+        if (line[pos] == delimiter) {
+            pos++;
+            continue;
+        }
+        size_t field_end = line.find(delimiter, pos);
+        if (field_end == std::string_view::npos)
+            field_end = line.size();
+        if (num_fields < max_fields)
+            fields[num_fields] = line.substr(pos, field_end - pos);
+        num_fields++;
+        pos = field_end;
+    }
+    return num_fields;
+}
+
+#ifdef FIELD_SCANNER_X86
+
+TARGET_SSE2 size_t splitViewSse2(std::string_view line, char delimiter, std::string_view* fields, size_t max_fields) {
+    constexpr size_t width = 16;
+    if (line.size() < width)
+        return splitViewScalar(line, delimiter, fields, max_fields);
+    FieldCollector collector(line, fields, max_fields);
+    const __m128i delimiters = _mm_set1_epi8(delimiter);
+    // (a lambda would be simpler, but wouldn't be compiled for the same instruction set as this function)
+#define FIND_DELIMITERS(p) (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p)), delimiters))
+    size_t block = 0;
+    for (; block + width <= line.size(); block += width)
+        collector.addDelimiters(block, FIND_DELIMITERS(line.data() + block));
+    if (block < line.size()) {
+        const size_t last = line.size() - width; // last block, overlapping the one before it
+        collector.addDelimiters(block, FIND_DELIMITERS(line.data() + last) >> (block - last));
+    }
+#undef FIND_DELIMITERS
+    return collector.finish(line.size());
+}
+
+TARGET_AVX2 size_t splitViewAvx2(std::string_view line, char delimiter, std::string_view* fields, size_t max_fields) {
+    constexpr size_t width = 32;
+    if (line.size() < width)
+        return splitViewSse2(line, delimiter, fields, max_fields);
+    FieldCollector collector(line, fields, max_fields);
+    const __m256i delimiters = _mm256_set1_epi8(delimiter);
+#define FIND_DELIMITERS(p) (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p)), delimiters))
+    size_t block = 0;
+    for (; block + width <= line.size(); block += width)
+        collector.addDelimiters(block, FIND_DELIMITERS(line.data() + block));
+    if (block < line.size()) {
+        const size_t last = line.size() - width;
+        collector.addDelimiters(block, FIND_DELIMITERS(line.data() + last) >> (block - last));
+    }
+#undef FIND_DELIMITERS
+    return collector.finish(line.size());
+}
+
+#endif
+
+bool cpuHas(SimdLevel level) {
+    if (level == SimdLevel::scalar)
+        return true;
+#ifdef FIELD_SCANNER_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    const int max_leaf = info[0];
+    __cpuid(info, 1);
+    if (level == SimdLevel::sse2)
+        return (info[3] & (1 << 26)) != 0;
+    // AVX2 also needs the OS to save the YMM registers
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (max_leaf < 7 || !osxsave || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return level == SimdLevel::sse2 ? __builtin_cpu_supports("sse2") : __builtin_cpu_supports("avx2");
+#endif
+#else
+    return false;
+#endif
+}
+
+using SplitFunction = size_t (*)(std::string_view, char, std::string_view*, size_t);
+
+SplitFunction splitFunction(SimdLevel level) {
+#ifdef FIELD_SCANNER_X86
+    if (level == SimdLevel::avx2)
+        return splitViewAvx2;
+    if (level == SimdLevel::sse2)
+        return splitViewSse2;
+#endif
+    return splitViewScalar;
+}
+
+SimdLevel bestSimdLevel() {
+    for (SimdLevel level : { SimdLevel::avx2, SimdLevel::sse2 }) {
+        if (cpuHas(level))
+            return level;
+    }
+    return SimdLevel::scalar;
+}
+
+SimdLevel simd_level = bestSimdLevel();
+SplitFunction split_function = splitFunction(simd_level);
+
+// exact powers of ten; a double holds up to 1e22 exactly
+constexpr double powers_of_ten[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+double parseSlow(std::string_view text) {
+    char buffer[64];
+    if (text.size() < sizeof(buffer)) {
+        memcpy(buffer, text.data(), text.size());
+        buffer[text.size()] = '\0';
+        return strtod(buffer, nullptr);
+    }
+    return strtod(std::string(text).c_str(), nullptr);
+}
+
+// true if any of the 4 values is below min_value
+bool anyBelow(const double (&values)[4], double min_value) {
+#ifdef FIELD_SCANNER_SSE2
+    const __m128d min = _mm_set1_pd(min_value);
+    const __m128d below = _mm_or_pd(_mm_cmplt_pd(_mm_loadu_pd(values), min), _mm_cmplt_pd(_mm_loadu_pd(values + 2), min));
+    return _mm_movemask_pd(below) != 0;
+#else
+    return (values[0] < min_value) | (values[1] < min_value) | (values[2] < min_value) | (values[3] < min_value);
+#endif
+}
+
+} // namespace
+
+SimdLevel simdLevel() {
+    return simd_level;
+}
+
+bool setSimdLevel(SimdLevel level) {
+    if (!cpuHas(level))
+        return false;
+    simd_level = level;
+    split_function = splitFunction(level);
+    return true;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::avx2: return "avx2";
+    case SimdLevel::sse2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+size_t splitView(std::string_view line, char delimiter, std::string_view* fields, size_t max_fields) {
+    return split_function(line, delimiter, fields, max_fields);
+}
+
+// An integer of up to 2^53 and a power of ten up to 1e22 are both exact doubles, so dividing one by the other rounds
+// once, correctly, which is the result strtod (and so atof) gives too
+double parseDecimal(std::string_view text) {
+    const char* p = text.data();
+    const char* const end = p + text.size();
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    const char* const int_start = p;
+    while (p < end && (unsigned)(*p - '0') < 10)
+        mantissa = mantissa * 10 + (*p++ - '0');
+    size_t num_digits = p - int_start;
+    size_t fraction_digits = 0;
+    if (p < end && *p == '.') {
+        const char* const fraction_start = ++p;
+        while (p < end && (unsigned)(*p - '0') < 10)
+            mantissa = mantissa * 10 + (*p++ - '0');
+        fraction_digits = p - fraction_start;
+        num_digits += fraction_digits;
+    }
+
+    // 19 digits can't overflow mantissa
+    if (p != end || num_digits == 0 || num_digits > 19 || mantissa > (uint64_t(1) << 53) || fraction_digits > 22)
+        return parseSlow(text);
+    const double value = (double)mantissa / powers_of_ten[fraction_digits];
+    return negative ? -value : value;
+}
+
+BarCheck checkBar(const std::string_view* fields, float min_value, bool check_sanity) {
+    double prices[4];
+    return checkBar(fields, min_value, check_sanity, prices);
+}
+
+BarCheck checkBar(const std::string_view* fields, float min_value, bool check_sanity, double (&prices)[4]) {
+    prices[0] = parseDecimal(fields[2]);
+    prices[1] = parseDecimal(fields[3]);
+    prices[2] = parseDecimal(fields[4]);
+    prices[3] = parseDecimal(fields[5]);
+    if (anyBelow(prices, min_value))
+        return BarCheck::below_min;
+    if (check_sanity) {
+        const double open = prices[0], high = prices[1], low = prices[2], close = prices[3];
+        // written so a NaN fails
+        if (!(high >= std::max(open, close)) || !(low <= std::min(open, close)) || !(parseDecimal(fields[6]) >= 0) || !(parseDecimal(fields[7]) >= 0))
+            return BarCheck::not_sane;
+    }
+    return BarCheck::ok;
+}
@@ -0,0 +1,38 @@
+//
+// FieldScanner.h : splits lines into fields and parses their prices, with SSE2 or AVX2 where the CPU has them
+//
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// instruction sets splitView can use. The best one the CPU has is used unless setSimdLevel says otherwise
+enum class SimdLevel { scalar, sse2, avx2 };
+
+SimdLevel simdLevel();
+// uses level from now on; false (and no change) if the CPU doesn't have it. For comparing them
+bool setSimdLevel(SimdLevel level);
+const char* simdLevelName(SimdLevel level);
+
+// splits line at delimiter without modifying or copying it; the first max_fields fields are returned as views into line
+// like strtok, empty fields are skipped. Returns the total number of fields in line, which may be more than max_fields.
+// The delimiters are found 16 or 32 bytes at a time
+size_t splitView(std::string_view line, char delimiter, std::string_view* fields, size_t max_fields);
+
+// text as a number, exactly as atof would convert it (text needn't be null terminated). Plain decimals like 123.45 are
+// converted here; anything else (exponents, very long numbers, junk) goes to strtod
+double parseDecimal(std::string_view text);
+
+enum class BarCheck {
+    ok,
+    below_min, // open, high, low or close is below minimum value
+    not_sane   // high below open or close, low above open or close, or up or down negative
+};
+
+// parses open, high, low and close (fields[2] to fields[5]) and compares them with min_value all at once. With
+// check_sanity, also checks that high and low really are the highest and lowest prices and that up and down
+// (fields[6] and fields[7]) aren't negative
+BarCheck checkBar(const std::string_view* fields, float min_value, bool check_sanity);
+// same, and hands back the prices it parsed (open, high, low, close) so they needn't be parsed again
+BarCheck checkBar(const std::string_view* fields, float min_value, bool check_sanity, double (&prices)[4]);
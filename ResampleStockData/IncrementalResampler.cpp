@@ -0,0 +1,405 @@
+//
+// IncrementalResampler.cpp : updates an output file from the bars appended to its input file since the last run
+//
+// The output file is the training days, then the validation days, then the test days, with dates counting up from the
+// first date of the input file. New days go at the end of their data set, so the validation and test days which are
+// already in the output file move to later dates whenever training days are added. Their lines are copied from the old
+// output file with new dates; only the input file's new lines are parsed.
+//
+// A sidecar file, <output>.state, records what's needed to carry on: how far the input file was parsed, where the data
+// set assignment is in its cycle and how many days and bytes each data set has. The last day of the input file might
+// get more bars, so it's parsed again by the next run and the state is as it was before that day.
+// Incremental updates need dates in ascending order; anything else (or a changed input or output file) is resampled
+// from scratch
+//
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ResampleStockData.h"
+#include "LineHandler.h"
+#include "MappedFile.h"
+
+using std::endl;
+using std::string;
+
+namespace {
+
+constexpr int state_version = 5;
+constexpr int no_dataset = -1;
+const char* const dataset_names[3] = { "training", "validation", "test" };
+
+struct IncrementalState {
+    string interval;              // as Interval::text()
+    string ratio;
+    float min_value{ 0 };
+    bool check_bars{ false };
+    string bar_size;              // as barSizeText
+    uint64_t input_size{ 0 };
+    uint64_t resume_offset{ 0 };  // first line of input file's last day, which is parsed again
+    uint64_t check_hash{ 0 };     // hash of input bytes [0, resume_offset), which must not have changed
+    uint64_t output_size{ 0 };
+    int64_t output_mtime{ 0 };
+    DayNumber initial_day{ 0 };   // first date of input file
+    bool have_previous_day{ false };
+    DayNumber previous_day{ 0 };  // date of day before last day
+    DatasetAssigner::State assigner{ false, 0, 0 };
+    uint64_t header_bytes{ 0 };
+    uint64_t days[3]{};           // # of days and bytes of each data set in output file, not counting last day
+    uint64_t bytes[3]{};
+    int last_dataset{ no_dataset }; // data set of last day, if it has any bars
+    uint64_t last_bytes{ 0 };
+};
+
+string ratioText(const std::vector<int>& ratio) {
+    return std::to_string(ratio[0]) + ":" + std::to_string(ratio[1]) + ":" + std::to_string(ratio[2]);
+}
+
+// --bar-size as the state file has it: minutes (0 for the input bars as they are) or session
+string barSizeText(const BarSize& bar_size) {
+    return bar_size.session ? "session" : std::to_string(bar_size.minutes);
+}
+
+bool readState(const std::filesystem::path& path, IncrementalState& state) {
+    std::ifstream file(path);
+    string key;
+    int version = 0;
+    if (!(file >> key >> version) || key != "version" || version != state_version)
+        return false;
+    int started = 0;
+    file >> key >> state.interval >> key >> state.ratio >> key >> state.min_value >> key >> state.check_bars >> key >> state.bar_size;
+    file >> key >> state.input_size >> key >> state.resume_offset >> key >> state.check_hash;
+    file >> key >> state.output_size >> key >> state.output_mtime;
+    file >> key >> state.initial_day >> key >> state.have_previous_day >> key >> state.previous_day;
+    file >> key >> started >> key >> state.assigner.start_period >> key >> state.assigner.day_count;
+    file >> key >> state.header_bytes;
+    for (int i = 0; i < 3; i++)
+        file >> key >> state.days[i] >> key >> state.bytes[i];
+    file >> key >> state.last_dataset >> key >> state.last_bytes;
+    state.assigner.started = started != 0;
+    return !file.fail();
+}
+
+bool writeState(const std::filesystem::path& path, const IncrementalState& state) {
+    std::ofstream file(path, std::ios::trunc);
+    file << "version " << state_version << "\n";
+    file << "interval " << state.interval << "\n";
+    file << "ratio " << state.ratio << "\n";
+    char min_value[30];
+    snprintf(min_value, sizeof(min_value), "%.9g", state.min_value);
+    file << "min_value " << min_value << "\n";
+    file << "check_bars " << state.check_bars << "\n";
+    file << "bar_size " << state.bar_size << "\n";
+    file << "input_size " << state.input_size << "\n";
+    file << "resume_offset " << state.resume_offset << "\n";
+    file << "check_hash " << state.check_hash << "\n";
+    file << "output_size " << state.output_size << "\n";
+    file << "output_mtime " << state.output_mtime << "\n";
+    file << "initial_day " << state.initial_day << "\n";
+    file << "have_previous_day " << state.have_previous_day << "\n";
+    file << "previous_day " << state.previous_day << "\n";
+    file << "assigner_started " << state.assigner.started << "\n";
+    file << "assigner_start_period " << state.assigner.start_period << "\n";
+    file << "assigner_day_count " << state.assigner.day_count << "\n";
+    file << "header_bytes " << state.header_bytes << "\n";
+    for (int i = 0; i < 3; i++) {
+        file << dataset_names[i] << "_days " << state.days[i] << "\n";
+        file << dataset_names[i] << "_bytes " << state.bytes[i] << "\n";
+    }
+    file << "last_dataset " << state.last_dataset << "\n";
+    file << "last_bytes " << state.last_bytes << "\n";
+    file.close();
+    return !file.fail();
+}
+
+// all of the input file before offset, so an edit anywhere in the part that isn't parsed again is noticed
+uint64_t checkHash(const MappedFile& input_file, uint64_t offset) {
+    return hashBytes(input_file.data(), offset);
+}
+
+// copies lines of old output file to output_file, giving them dates from first_day on. A day's lines all have the same
+// date, and the next day has a different one, so a change of date is a new day
+void copyDays(std::string_view lines, DayNumber first_day, OutputWriter& output_file) {
+    char date[formatted_date_size];
+    const char* previous = nullptr;
+    DayNumber day = first_day - 1;
+    const char* next = lines.data();
+    const char* const end = next + lines.size();
+    while (next < end) {
+        const char* eol = (const char*)memchr(next, '\n', end - next);
+        eol = eol != nullptr ? eol + 1 : end;
+        if (previous == nullptr || memcmp(previous, next, formatted_date_size) != 0) {
+            formatDate(++day, date);
+            previous = next;
+        }
+        output_file.write(std::string_view(date, formatted_date_size));
+        output_file.write(std::string_view(next + formatted_date_size, eol - next - formatted_date_size));
+        next = eol;
+    }
+}
+
+// new days of one data set: lines as they go in the output file, except for the date at the start of each line
+struct NewDays {
+    string text;
+    std::vector<uint32_t> bars_per_day;
+};
+
+void writeNewDays(const NewDays& days, DayNumber first_day, OutputWriter& output_file) {
+    char date[formatted_date_size];
+    size_t pos = 0;
+    DayNumber day = first_day;
+    for (uint32_t num_bars : days.bars_per_day) {
+        formatDate(day++, date);
+        for (uint32_t i = 0; i < num_bars; i++) {
+            const size_t eol = days.text.find('\n', pos) + 1;
+            output_file.write(std::string_view(date, formatted_date_size));
+            output_file.write(std::string_view(days.text).substr(pos + formatted_date_size, eol - pos - formatted_date_size));
+            pos = eol;
+        }
+    }
+}
+
+} // namespace
+
+bool ProcessCSVFileIncremental(const Options& options, const std::filesystem::path& input_path, const std::filesystem::path& output_path, std::ostream& log,
+    FileStats& stats) {
+    std::filesystem::path state_path = output_path;
+    state_path += ".state";
+    std::filesystem::path temp_path = output_path;
+    temp_path += ".tmp";
+    std::error_code ec;
+
+    // resamples the whole file the usual way; for input this mode can't handle. The usual way reports any errors
+    auto resampleWholeFile = [&]() {
+        stats.restart();
+        std::filesystem::remove(state_path, ec);
+        OutputWriter output_file(output_buffer_size, options.gather_writes);
+        if (!output_file.open(output_path)) {
+            log << "***Error*** Unable to create '" << output_path.string() << "' for writing. It might be locked by another program." << endl;
+            return false;
+        }
+        stats.bytes_read = std::filesystem::file_size(input_path, ec);
+        const bool rc = ProcessMappedCSVFile(options, input_path, output_file, log, stats);
+        stats.bytes_written += output_file.bytesWritten();
+        return rc;
+    };
+
+    const auto open_start = std::chrono::steady_clock::now();
+    MappedFile input_file;
+    if (!input_file.open(input_path)) {
+        log << "***Error*** Unable to open '" << input_path << "' for reading." << endl;
+        return false;
+    }
+
+    // carry on from state of last run if input file has only grown (every byte before the resume offset is as it was) and
+    // output file is as it was left
+    IncrementalState old_state;
+    MappedFile old_output;
+    bool incremental = readState(state_path, old_state) && old_state.interval == options.interval.text() &&
+        old_state.ratio == ratioText(options.ratio) && old_state.min_value == options.min_value && old_state.check_bars == options.check_bars &&
+        old_state.bar_size == barSizeText(options.bar_size) &&
+        old_state.input_size <= input_file.size() && old_state.resume_offset <= old_state.input_size &&
+        old_state.check_hash == checkHash(input_file, old_state.resume_offset) &&
+        old_output.open(output_path) && old_output.size() == old_state.output_size && modificationTime(output_path) == old_state.output_mtime &&
+        old_state.header_bytes + old_state.bytes[0] + old_state.bytes[1] + old_state.bytes[2] + old_state.last_bytes == old_output.size();
+    if (!incremental)
+        old_state = IncrementalState{};
+    stats.open_seconds += secondsSince(open_start);
+
+    const char* next = input_file.data();
+    const char* const end = next + input_file.size();
+    std::string_view line;
+    if (incremental)
+        next += old_state.resume_offset;
+    else {
+        // read header;
+        if (!nextLine(next, end, line))
+            return resampleWholeFile();
+        if (line != "\"Date\",\"Time\",\"Open\",\"High\",\"Low\",\"Close\",\"Up\",\"Down\"" && line != "Date,Time,Open,High,Low,Close,Up,Down")
+            log << "***Warning*** First line is not expected header:" << "Date,Time,Open,High,Low,Close,Up,Down" << endl;
+    }
+    const uint64_t parse_offset = next - input_file.data();
+
+    IncrementalState state = old_state;
+    state.interval = options.interval.text();
+    state.ratio = ratioText(options.ratio);
+    state.min_value = options.min_value;
+    state.check_bars = options.check_bars;
+    state.bar_size = barSizeText(options.bar_size);
+    DatasetAssigner assigner(options.interval, options.ratio);
+    assigner.restore(old_state.assigner);
+    NewDays new_days[3];
+
+    // sends a complete day to its data set
+    DayBuffer day_buffer; // current day's lines, with room for the date at the start of each
+    auto saveDay = [&](DayNumber day, const DayBuffer& day_bars) -> int {
+        if (day_bars.empty())
+            return no_dataset;
+        const int dataset = assigner.assign(day);
+        new_days[dataset].text += day_bars.text();
+        new_days[dataset].bars_per_day.push_back((uint32_t)day_bars.numBars());
+        stats.days_kept++;
+        stats.bars_kept += day_bars.numBars();
+        state.days[dataset]++;
+        state.bytes[dataset] += day_bars.text().size();
+        return dataset;
+    };
+    DayBufferBars day_bars(day_buffer, [&](DayNumber day, DayBuffer& bars) {
+        saveDay(day, bars);
+        return true;
+    });
+
+    // Read data, line by line. A day is complete when the date changes. Invalid lines aren't reported here; the whole
+    // file is resampled, which reports them
+    const auto parse_start = std::chrono::steady_clock::now();
+    std::ostringstream ignored;
+    LineHandler handler(options, stats, ignored, log);
+    std::string_view fields[8];
+    DayNumber t;
+    const char* day_start = next; // first line of current day
+    const char* line_start = next;
+    while (line_start = next, nextLine(next, end, line))
+    {
+        stats.lines++;
+        if (!handler.parse(line, fields, t))
+            return resampleWholeFile();
+
+        if (!handler.started() || t != handler.currentDay()) {
+            // new day must come after all others
+            if ((handler.started() && t < handler.currentDay()) || (!handler.started() && state.have_previous_day && t <= state.previous_day)) {
+                log << "***Warning*** Dates aren't in ascending order; resampling whole file" << endl;
+                return resampleWholeFile();
+            }
+            if (handler.started()) {
+                state.have_previous_day = true;
+                state.previous_day = handler.currentDay();
+            }
+            day_start = line_start;
+        }
+        if (!handler.handle(line, fields, t, day_bars))
+            return resampleWholeFile();
+    }
+
+    // last day is parsed again next time, so state is as it was before it
+    if (handler.started()) {
+        if (!incremental)
+            state.initial_day = handler.initialDay();
+        handler.finishBar(day_bars);
+        state.resume_offset = day_start - input_file.data();
+        state.assigner = assigner.state();
+        state.last_dataset = saveDay(handler.currentDay(), day_buffer);
+        state.last_bytes = state.last_dataset == no_dataset ? 0 : day_buffer.text().size();
+        if (state.last_dataset != no_dataset) {
+            state.days[state.last_dataset]--;
+            state.bytes[state.last_dataset] -= state.last_bytes;
+        }
+    }
+    else if (!incremental)
+        return resampleWholeFile(); // no data lines
+    state.input_size = input_file.size();
+    state.check_hash = checkHash(input_file, state.resume_offset);
+
+    uint64_t total_days[3];
+    for (int i = 0; i < 3; i++)
+        total_days[i] = state.days[i] + (state.last_dataset == i ? 1 : 0);
+    if (total_days[0] + total_days[1] + total_days[2] == 0) {
+        log << "***Error*** After filtering for minimum value, input file is empty" << endl;
+        return resampleWholeFile();
+    }
+    stats.parse_seconds = secondsSince(parse_start);
+    stats.bytes_read = (end - input_file.data()) - parse_offset;
+    log << "Parsed " << (end - input_file.data()) - parse_offset << " of " << input_file.size() << " bytes of input file" << endl;
+
+    // write new output file next to old one, then replace it
+    const auto write_start = std::chrono::steady_clock::now();
+    OutputWriter output_file(output_buffer_size);
+    if (!output_file.open(temp_path)) {
+        log << "***Error*** Unable to create '" << temp_path.string() << "' for writing." << endl;
+        return false;
+    }
+    const char* old_text = old_output.data();
+    if (incremental) {
+        output_file.write(std::string_view(old_text, old_state.header_bytes));
+        old_text += old_state.header_bytes;
+    }
+    else {
+        writeHeader(output_file);
+        output_file.flush();
+        state.header_bytes = output_file.bytesWritten();
+    }
+
+    DayNumber first_day = state.initial_day;
+    for (int i = 0; i < 3; i++) {
+        // days already in output file (except last day, which is in new_days if it still has bars), then new days
+        if (incremental) {
+            copyDays(std::string_view(old_text, old_state.bytes[i]), first_day, output_file);
+            old_text += old_state.bytes[i] + (old_state.last_dataset == i ? old_state.last_bytes : 0);
+        }
+        writeNewDays(new_days[i], first_day + (DayNumber)old_state.days[i], output_file);
+
+        char from[formatted_date_size + 1]{};
+        char to[formatted_date_size + 1]{};
+        formatDate(first_day, from);
+        formatDate(first_day + (DayNumber)total_days[i] - 1, to);
+        log << "Writing " << dataset_names[i] << " dataset from " << from << "  to " << to << endl;
+        first_day += (DayNumber)total_days[i];
+    }
+    old_output.close();
+
+    if (!output_file.close()) {
+        log << "***Error*** Unable to write output file. The disk might be full." << endl;
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    std::filesystem::rename(temp_path, output_path, ec);
+    if (ec) {
+        log << "***Error*** Unable to replace '" << output_path.string() << "'. It might be locked by another program." << endl;
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    stats.write_seconds += secondsSince(write_start);
+    stats.bytes_written += output_file.bytesWritten();
+    logWriteSpeed(output_file, std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count(), log);
+
+    state.output_size = output_file.bytesWritten();
+    state.output_mtime = modificationTime(output_path);
+    if (!writeState(state_path, state))
+        log << "***Warning*** Unable to write '" << state_path.string() << "'; next run will resample whole file" << endl;
+
+    // compare with a full run, and keep the full run's output if they differ
+    if (options.verify) {
+        std::filesystem::path verify_path = output_path;
+        verify_path += ".verify";
+        std::ostringstream full_log;
+        FileStats full_stats; // the check isn't part of the file's stats
+        bool full_ok;
+        {
+            OutputWriter full_output(output_buffer_size);
+            full_ok = full_output.open(verify_path) && ProcessMappedCSVFile(options, input_path, full_output, full_log, full_stats);
+        }
+        MappedFile incremental_result, full_result;
+        if (!full_ok || !incremental_result.open(output_path) || !full_result.open(verify_path)) {
+            log << "***Error*** Unable to verify output file" << endl;
+            std::filesystem::remove(verify_path, ec);
+            return false;
+        }
+        if (incremental_result.view() == full_result.view()) {
+            log << "Verified: output file is the same as a full run's" << endl;
+            full_result.close();
+            std::filesystem::remove(verify_path, ec);
+        }
+        else {
+            log << "***Error*** Output file differs from a full run's; keeping full run's output" << endl;
+            incremental_result.close();
+            full_result.close();
+            std::filesystem::rename(verify_path, output_path, ec);
+            std::filesystem::remove(state_path, ec);
+            return false;
+        }
+    }
+    return true;
+}
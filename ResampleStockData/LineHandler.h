@@ -0,0 +1,230 @@
+//
+// LineHandler.h : what's done with each data line of an input file, whichever way the file is read
+//
+
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "ResampleStockData.h"
+
+// Splits each line into fields, converts its date, finds where days start and end (and duplicate dates), applies the
+// minimum value filter and --check-bars and, with --bar-size, folds the bars into coarser ones. Every way of reading a
+// file (ProcessCSVFile, the chunks of a memory mapped file, streaming, --pipeline, --sort, --incremental) hands its
+// lines to one of these, so they all treat them the same way. What's kept goes to Bars, which has:
+//   bool endDay()                                       the day is complete; false if its date was seen before (so its
+//                                                       bars are dropped)
+//   bool beginDay(DayNumber date, std::string_view line)  a day starts with line; false stops the file
+//   void clearDay()                                     throws away the day's bars so far
+//   bool addBar(std::string_view line, const std::string_view* fields)  keeps line's bar; false (having logged why)
+//                                                       stops the file
+//   void addAggregated(const BarAggregator& aggregator)  keeps the coarser bar aggregator just finished
+// Errors go to log and warnings to warnings, which can be the same stream
+class LineHandler {
+public:
+    LineHandler(const Options& options, FileStats& stats, std::ostream& log, std::ostream& warnings)
+        : options_(options), stats_(stats), log_(log), warnings_(warnings), aggregating_(options.bar_size.aggregating()), aggregator_(options.bar_size) {}
+    LineHandler(const Options& options, FileStats& stats, std::ostream& log) : LineHandler(options, stats, log, log) {}
+
+    // splits line into fields and converts its date. Returns false (with an error logged) if it can't
+    bool parse(std::string_view line, std::string_view (&fields)[8], DayNumber& date) {
+        if (splitView(line, ',', fields, 8) != 8) {
+            log_ << "***Error*** There must be 8 comma separated fields: " << line << std::endl;
+            return false;
+        }
+        date_timer_.start();
+        if (!DateStringToDayNumber(line, fields[0], date_parser_, date, log_))
+            return false;
+        date_timer_.stop(stats_.date_seconds);
+        return true;
+    }
+
+    // the next line of the file. Returns false if it's invalid (with an error logged) or bars stopped the file
+    template <typename Bars>
+    bool handle(std::string_view line, Bars& bars) {
+        std::string_view fields[8];
+        DayNumber date;
+        return parse(line, fields, date) && handle(line, fields, date, bars);
+    }
+
+    // same, for a line that's been parsed
+    template <typename Bars>
+    bool handle(std::string_view line, const std::string_view* fields, DayNumber date, Bars& bars) {
+        // if new day, previous day is complete
+        if (!started_ || date != cur_day_) {
+            bool skip_line;
+            if (!newDay(date, line, bars, skip_line))
+                return false;
+            if (skip_line)
+                return true;
+        }
+
+        // check open, high, low, close for minimum value (and with --check-bars, that the bar makes sense)
+        filter_timer_.start();
+        double prices[4];
+        const BarCheck check = checkBar(fields, options_.min_value, options_.check_bars, prices);
+        filter_timer_.stop(stats_.filter_seconds);
+        if (!filter(check, line, bars))
+            return true;
+
+        // with --bar-size, the bar is folded into the coarser bar it's part of, which is kept once it's complete
+        if (aggregating_) {
+            bool finished;
+            if (!aggregator_.add(fields, prices, finished)) {
+                log_ << "***Error*** Time must be hh:mm or hh:mm:ss for --bar-size: " << line << std::endl;
+                return false;
+            }
+            if (finished)
+                bars.addAggregated(aggregator_);
+            return true;
+        }
+        return bars.addBar(line, fields);
+    }
+
+    // ends the day before (if any) and starts date's day, whose first line is line. skip_line is set if line's bar has
+    // to be skipped, as the line after a duplicate day always has been. Returns false if bars stopped the file
+    template <typename Bars>
+    bool newDay(DayNumber date, std::string_view line, Bars& bars, bool& skip_line) {
+        skip_line = false;
+        if (started_) {
+            finishBar(bars);
+            if (!bars.endDay()) {
+                log_ << "***Error*** Duplicate date: " << line << std::endl;
+                stats_.duplicate_dates++;
+                // a coarser bar has all of its lines
+                skip_line = !aggregating_;
+            }
+        }
+        else {
+            initial_day_ = date;
+            started_ = true;
+        }
+        cur_day_ = date;
+        stats_.days_read++;
+        return bars.beginDay(date, line);
+    }
+
+    // what a bar that failed check does: one below the minimum value throws away all prior bars of its day, one that
+    // doesn't make sense is skipped. Returns true if the bar is to be kept
+    template <typename Bars>
+    bool filter(BarCheck check, std::string_view line, Bars& bars) {
+        if (check == BarCheck::below_min) {
+            bars.clearDay();
+            aggregator_.clear();
+            stats_.below_min_bars++;
+            return false;
+        }
+        if (check == BarCheck::not_sane) {
+            warnings_ << "***Warning*** High or low is not the highest or lowest price, or up or down is negative; bar skipped: " << line << std::endl;
+            stats_.bad_bars++;
+            return false;
+        }
+        return true;
+    }
+
+    // keeps the coarser bar being built (--bar-size), at the end of a day
+    template <typename Bars>
+    void finishBar(Bars& bars) {
+        if (aggregating_ && aggregator_.finish())
+            bars.addAggregated(aggregator_);
+    }
+
+    // at the end of the file, saves the last day. last_line is for the duplicate date message
+    template <typename Bars>
+    void finish(std::string_view last_line, Bars& bars) {
+        if (!started_)
+            return;
+        finishBar(bars);
+        if (!bars.endDay()) {
+            log_ << "***Error*** Duplicate date: " << last_line << std::endl;
+            stats_.duplicate_dates++;
+        }
+    }
+
+    // whether there's been a line yet, the date of the first one and that of the day being read
+    bool started() const { return started_; }
+    DayNumber initialDay() const { return initial_day_; }
+    DayNumber currentDay() const { return cur_day_; }
+
+private:
+    const Options& options_;
+    FileStats& stats_;
+    std::ostream& log_;
+    std::ostream& warnings_;
+    DateParser date_parser_;
+    SampledTimer date_timer_, filter_timer_;
+    const bool aggregating_;
+    BarAggregator aggregator_;
+    bool started_{ false };
+    DayNumber initial_day_{ 0 };
+    DayNumber cur_day_{ 0 };
+};
+
+// Bars for the ways of reading a file that keep all bars in a BarStore until the file has been read. The text of each
+// kept bar is copied to arena, without any empty fields (which splitView skips)
+class StoredBars {
+public:
+    StoredBars(BarStore& bars, TextArena& arena, std::ostream& log) : bars_(bars), arena_(arena), log_(log) {}
+
+    bool endDay() { return bars_.endDay(); }
+    bool beginDay(DayNumber date, std::string_view) {
+        bars_.beginDay(date);
+        return true;
+    }
+    void clearDay() { bars_.clearDay(); }
+    bool addBar(std::string_view line, const std::string_view* fields) {
+        // copy date,time,open,...,down to bar text, with single commas
+        bar_.assign(fields[0]);
+        (bar_ += ',') += fields[1];
+        const size_t values_start = bar_.size() + 1;
+        for (int i = 2; i < 8; i++)
+            (bar_ += ',') += fields[i];
+        if (!BarView::fits(fields[0].size(), fields[1].size(), bar_.size() - values_start)) {
+            log_ << "***Error*** Line is too long: " << line << std::endl;
+            return false;
+        }
+        bars_.addBar(BarView(arena_.copy(bar_).data(), fields[0].size(), fields[1].size(), bar_.size() - values_start));
+        return true;
+    }
+    void addAggregated(const BarAggregator& aggregator) { bars_.addBar(aggregator.copyTo(arena_)); }
+
+private:
+    BarStore& bars_;
+    TextArena& arena_;
+    std::ostream& log_;
+    std::string bar_; // text of bar being built, reused for every line
+};
+
+// Bars for the ways of reading a file that write each day as soon as it's complete: the day's bars are built in
+// day_bars, and save(date, day_bars) is called when it's complete if it has any. save returns false if the date was
+// seen before. day_bars is cleared after it
+template <typename Save>
+class DayBufferBars {
+public:
+    DayBufferBars(DayBuffer& day_bars, Save save) : day_bars_(day_bars), save_(save) {}
+
+    bool endDay() {
+        if (day_bars_.empty())
+            return true;
+        const bool saved = save_(date_, day_bars_);
+        day_bars_.clear();
+        return saved;
+    }
+    bool beginDay(DayNumber date, std::string_view) {
+        date_ = date;
+        return true;
+    }
+    void clearDay() { day_bars_.clear(); }
+    bool addBar(std::string_view, const std::string_view* fields) {
+        day_bars_.addBar(fields[0], fields[1], fields + 2);
+        return true;
+    }
+    void addAggregated(const BarAggregator& aggregator) { day_bars_.addBar(aggregator.fields()[0], aggregator.fields()[1], aggregator.fields() + 2); }
+
+private:
+    DayBuffer& day_bars_;
+    Save save_;
+    DayNumber date_{ 0 };
+};
@@ -0,0 +1,104 @@
+//
+// MappedFile.cpp : read-only memory mapping of an input file
+//
+
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::filesystem::path& path) {
+    close();
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    file_handle_ = file;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        close();
+        return false;
+    }
+    size_ = (size_t)file_size.QuadPart;
+    if (size_ == 0)
+        return true; // CreateFileMapping fails on empty files, so there is nothing to map
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        close();
+        return false;
+    }
+    mapping_handle_ = mapping;
+
+    data_ = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data_ == nullptr) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_ != nullptr)
+        UnmapViewOfFile(data_);
+    if (mapping_handle_ != nullptr)
+        CloseHandle((HANDLE)mapping_handle_);
+    if (file_handle_ != nullptr)
+        CloseHandle((HANDLE)file_handle_);
+    data_ = nullptr;
+    size_ = 0;
+    mapping_handle_ = nullptr;
+    file_handle_ = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::filesystem::path& path) {
+    close();
+
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        close();
+        return false;
+    }
+    size_ = (size_t)st.st_size;
+    if (size_ == 0)
+        return true; // mmap fails on empty files, so there is nothing to map
+
+    void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (p == MAP_FAILED) {
+        close();
+        return false;
+    }
+    // we read the file front to back exactly once
+    madvise(p, size_, MADV_SEQUENTIAL);
+    data_ = (const char*)p;
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_ != nullptr)
+        munmap((void*)data_, size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+    data_ = nullptr;
+    size_ = 0;
+    fd_ = -1;
+}
+
+#endif
@@ -0,0 +1,36 @@
+//
+// MappedFile.h : read-only memory mapping of an input file
+//
+
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+
+// maps a whole file read-only into memory so it can be tokenized in place
+// the mapping (and every view into it) is valid until close() is called or the object is destroyed
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // returns false if file can't be opened or mapped; an empty file is opened successfully and has size() == 0
+    bool open(const std::filesystem::path& path);
+    void close();
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    std::string_view view() const { return std::string_view(data_, size_); }
+
+private:
+    const char* data_{ nullptr };
+    size_t size_{ 0 };
+#ifdef _WIN32
+    void* file_handle_{ nullptr };
+    void* mapping_handle_{ nullptr };
+#else
+    int fd_{ -1 };
+#endif
+};
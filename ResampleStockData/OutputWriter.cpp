@@ -0,0 +1,244 @@
+//
+// OutputWriter.cpp : buffered output file which writes in a few large system calls
+//
+
+#include "OutputWriter.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// referenced text shorter than this is cheaper to copy than to give its own iovec
+constexpr size_t min_reference_size = 32;
+#ifndef _WIN32
+#ifdef IOV_MAX
+constexpr size_t max_slices = IOV_MAX;
+#else
+constexpr size_t max_slices = 1024;
+#endif
+#endif
+
+OutputWriter::OutputWriter(size_t buffer_size, bool gather) : buffer_(std::max<size_t>(buffer_size, 4096)) {
+#ifndef _WIN32
+    gather_ = gather;
+#else
+    (void)gather; // no writev on Windows; referenced text is copied
+#endif
+}
+
+OutputWriter::~OutputWriter() {
+    // a replacement that wasn't closed isn't finished, so it mustn't replace anything
+    if (!temp_path_.empty())
+        failed_ = true;
+    close();
+}
+
+bool OutputWriter::open(const std::filesystem::path& path, Compression compression, bool replace) {
+    close();
+    failed_ = false;
+    bytes_written_ = 0;
+    path_ = path;
+    compressor_.reset();
+    if (compression != Compression::none) {
+        compressor_ = std::make_unique<Compressor>(compression);
+        if (!compressor_->ok())
+            return false;
+    }
+    temp_path_.clear();
+    if (replace) {
+        temp_path_ = path;
+        temp_path_ += ".tmp";
+    }
+    if (!openFile(replace ? temp_path_ : path)) {
+        temp_path_.clear();
+        return false;
+    }
+    return true;
+}
+
+bool OutputWriter::finishReplace(bool keep) {
+    if (temp_path_.empty())
+        return keep;
+    std::error_code ec;
+    if (keep) {
+        std::filesystem::rename(temp_path_, path_, ec);
+        keep = !ec;
+    }
+    if (!keep)
+        std::filesystem::remove(temp_path_, ec);
+    temp_path_.clear();
+    return keep;
+}
+
+void OutputWriter::writeOverflow(std::string_view text) {
+    flush();
+    if (text.size() <= buffer_.size()) {
+        memcpy(buffer_.data(), text.data(), text.size());
+        used_ = text.size();
+    }
+    else if (!writeOut(text.data(), text.size()))
+        failed_ = true;
+}
+
+bool OutputWriter::writeOut(const char* data, size_t size, bool finish) {
+    if (compressor_ == nullptr)
+        return writeAll(data, size);
+    std::string_view compressed;
+    return compressor_->compress(std::string_view(data, size), finish, compressed) && writeAll(compressed.data(), compressed.size());
+}
+
+void OutputWriter::writeReference(std::string_view text) {
+    if (!gather_ || compressor_ != nullptr || text.size() < min_reference_size) {
+        write(text);
+        return;
+    }
+#ifndef _WIN32
+    if (used_ > sliced_) {
+        slices_.push_back(Slice{ nullptr, sliced_, used_ - sliced_ });
+        sliced_ = used_;
+    }
+    slices_.push_back(Slice{ text.data(), 0, text.size() });
+    if (slices_.size() + 1 >= max_slices) // leave room for the rest of the buffer
+        flush();
+#endif
+}
+
+bool OutputWriter::flush() {
+    if (!is_open())
+        return false;
+
+#ifndef _WIN32
+    if (!slices_.empty()) {
+        if (used_ > sliced_)
+            slices_.push_back(Slice{ nullptr, sliced_, used_ - sliced_ });
+
+        std::vector<iovec> iov;
+        iov.reserve(slices_.size());
+        for (const Slice& slice : slices_)
+            iov.push_back(iovec{ (void*)(slice.data != nullptr ? slice.data : buffer_.data() + slice.offset), slice.size });
+
+        // writev may write less than asked for; carry on from where it stopped
+        size_t first = 0;
+        while (first < iov.size() && !failed_) {
+            ssize_t written = writev(fd_, iov.data() + first, (int)std::min(iov.size() - first, max_slices));
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                failed_ = true;
+                break;
+            }
+            bytes_written_ += (uint64_t)written;
+            while (first < iov.size() && (size_t)written >= iov[first].iov_len)
+                written -= (ssize_t)iov[first++].iov_len;
+            if (first < iov.size()) {
+                iov[first].iov_base = (char*)iov[first].iov_base + written;
+                iov[first].iov_len -= (size_t)written;
+            }
+        }
+
+        slices_.clear();
+        used_ = 0;
+        sliced_ = 0;
+        return !failed_;
+    }
+#endif
+
+    if (used_ > 0 && !writeOut(buffer_.data(), used_))
+        failed_ = true;
+    used_ = 0;
+    sliced_ = 0;
+    return !failed_;
+}
+
+#ifdef _WIN32
+
+bool OutputWriter::openFile(const std::filesystem::path& path) {
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    handle_ = file;
+    return true;
+}
+
+bool OutputWriter::close() {
+    if (!is_open())
+        return !failed_;
+    flush();
+    if (compressor_ != nullptr && !writeOut(nullptr, 0, true))
+        failed_ = true;
+    if (!CloseHandle((HANDLE)handle_))
+        failed_ = true;
+    handle_ = nullptr;
+    if (!finishReplace(!failed_))
+        failed_ = true;
+    return !failed_;
+}
+
+bool OutputWriter::is_open() const {
+    return handle_ != nullptr;
+}
+
+bool OutputWriter::writeAll(const char* data, size_t size) {
+    while (size > 0) {
+        const DWORD chunk = (DWORD)std::min<size_t>(size, 1u << 30);
+        DWORD written = 0;
+        if (!WriteFile((HANDLE)handle_, data, chunk, &written, nullptr))
+            return false;
+        bytes_written_ += written;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+#else
+
+bool OutputWriter::openFile(const std::filesystem::path& path) {
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    return fd_ >= 0;
+}
+
+bool OutputWriter::close() {
+    if (!is_open())
+        return !failed_;
+    flush();
+    if (compressor_ != nullptr && !writeOut(nullptr, 0, true))
+        failed_ = true;
+    if (::close(fd_) != 0)
+        failed_ = true;
+    fd_ = -1;
+    if (!finishReplace(!failed_))
+        failed_ = true;
+    return !failed_;
+}
+
+bool OutputWriter::is_open() const {
+    return fd_ >= 0;
+}
+
+bool OutputWriter::writeAll(const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd_, data, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        bytes_written_ += (uint64_t)written;
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+#endif
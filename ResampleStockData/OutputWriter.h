@@ -0,0 +1,95 @@
+//
+// OutputWriter.h : buffered output file which writes in a few large system calls
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+#include "Compression.h"
+
+// what std::endl wrote when output files were std::ofstreams opened in text mode
+#ifdef _WIN32
+constexpr std::string_view line_end = "\r\n";
+#else
+constexpr std::string_view line_end = "\n";
+#endif
+
+// Collects output in a large buffer and writes it with one system call whenever the buffer is full.
+// In gather mode (POSIX only), writeReference doesn't copy its argument; the writer just remembers where it is and
+// hands it to writev along with the buffered data. Referenced text must therefore stay unchanged until the next
+// flush(), close() or destruction.
+// A compressed file is compressed a buffer at a time as it's written, and is never gathered.
+// A file opened with replace is written as <path>.tmp and only renamed to path by close(), so anyone reading path sees
+// the old file or the new one, never half of one. If the writer is destroyed without close() (or a write failed), the
+// .tmp file is removed and path is left as it was
+class OutputWriter {
+public:
+    explicit OutputWriter(size_t buffer_size = 1024 * 1024, bool gather = false);
+    ~OutputWriter();
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    // creates (or truncates) file, compressed as asked; returns false if that fails
+    bool open(const std::filesystem::path& path, Compression compression = Compression::none, bool replace = false);
+    // writes anything still buffered and closes file (renaming it over path, if it was opened with replace); returns
+    // false if any write failed
+    bool close();
+    bool is_open() const;
+    // file given to last open()
+    const std::filesystem::path& path() const { return path_; }
+
+    void write(std::string_view text) {
+        if (text.size() > buffer_.size() - used_) {
+            writeOverflow(text);
+            return;
+        }
+        memcpy(buffer_.data() + used_, text.data(), text.size());
+        used_ += text.size();
+    }
+    void write(char c) { write(std::string_view(&c, 1)); }
+    void writeReference(std::string_view text);
+    bool flush();
+
+    // true if gather mode was requested and is supported on this platform
+    bool gathering() const { return gather_; }
+    // to the file, so after compression
+    uint64_t bytesWritten() const { return bytes_written_; }
+    bool failed() const { return failed_; }
+
+private:
+    struct Slice {
+        const char* data; // nullptr means buffer_ at offset
+        size_t offset;
+        size_t size;
+    };
+
+    void writeOverflow(std::string_view text);
+    // through compressor_, if there is one; finish ends the compressed stream
+    bool writeOut(const char* data, size_t size, bool finish = false);
+    bool writeAll(const char* data, size_t size);
+    // the platform's part of open()
+    bool openFile(const std::filesystem::path& path);
+    // after a file opened with replace is closed: renames it to path_ if keep, otherwise removes it. False if it's not kept
+    bool finishReplace(bool keep);
+
+    std::vector<char> buffer_;
+    size_t used_{ 0 };
+    size_t sliced_{ 0 };        // buffer_[0, sliced_) is already described by slices_
+    std::vector<Slice> slices_; // gather mode: what to write, in order
+    bool gather_{ false };
+    bool failed_{ false };
+    uint64_t bytes_written_{ 0 };
+    std::filesystem::path path_;
+    std::filesystem::path temp_path_; // replace: what's written until close()
+    std::unique_ptr<Compressor> compressor_;
+#ifdef _WIN32
+    void* handle_{ nullptr };
+#else
+    int fd_{ -1 };
+#endif
+};
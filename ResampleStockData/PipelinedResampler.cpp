@@ -0,0 +1,293 @@
+//
+// PipelinedResampler.cpp : resamples a file with reading, parsing and writing each on a thread of its own (--pipeline)
+//
+// The reader reads the file in large blocks which end at the end of a line. The parser splits the lines of each block,
+// converts dates, applies the minimum value filter and builds each day's output lines. The writer (the calling thread)
+// sends each complete day to its data set with a DatasetWriter, just as streaming mode does, so the output file is
+// written while the rest of the file is still being read and parsed. The stages are connected by bounded queues, and
+// blocks and day buffers go back to the stage which fills them once they are used, so memory use is a few blocks and
+// days however large the file is, and a stage which gets ahead waits for the one after it.
+// Like streaming mode, the dates in the input file must be in ascending order.
+//
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include "ResampleStockData.h"
+#include "LineHandler.h"
+#include "SpscQueue.h"
+
+using std::endl;
+using std::string;
+
+namespace {
+
+constexpr size_t block_size = 1024 * 1024;
+constexpr size_t num_blocks = 4;    // blocks being read, parsed or waiting for either
+constexpr size_t num_day_buffers = 64; // days being built or written, or waiting for either
+
+// part of the input file: whole lines, except when a line doesn't fit a block (which is then made bigger)
+struct TextBlock {
+    std::unique_ptr<char[]> data;
+    size_t capacity{ 0 };
+    size_t size{ 0 };
+
+    void grow(size_t new_capacity) {
+        std::unique_ptr<char[]> new_data(new char[new_capacity]);
+        memcpy(new_data.get(), data.get(), size);
+        data = std::move(new_data);
+        capacity = new_capacity;
+    }
+};
+
+// a complete day, ready for its data set
+struct FinishedDay {
+    DayNumber date{ 0 };
+    DayBuffer bars;
+};
+
+// how long a stage ran and how much of that it spent waiting for the stages next to it
+struct StageTime {
+    double total{ 0 };
+    double waiting{ 0 };
+    double busy() const { return total - waiting; }
+};
+
+// reads the file into blocks from free_blocks and passes them on in full_blocks. The part of the last line in a block
+// is moved to the start of the next block. A compressed file comes through a DecompressingStream, whose thread makes
+// this a four stage pipeline
+void readStage(std::istream& input_file, SpscQueue<TextBlock>& free_blocks, SpscQueue<TextBlock>& full_blocks, bool& read_failed,
+    std::ostream& log, StageTime& time) {
+    const auto stage_start = std::chrono::steady_clock::now();
+    string partial_line;
+    TextBlock block;
+    bool at_end = false;
+    while (!at_end && free_blocks.pop(block)) {
+        block.size = 0;
+        if (block.capacity < partial_line.size() + block_size / 2)
+            block.grow(partial_line.size() + block_size);
+        memcpy(block.data.get(), partial_line.data(), partial_line.size());
+        block.size = partial_line.size();
+        partial_line.clear();
+
+        // fill block, making it bigger if it doesn't hold a whole line
+        const char* last_eol = nullptr;
+        while (last_eol == nullptr && !at_end) {
+            if (block.size == block.capacity)
+                block.grow(2 * block.capacity);
+            const size_t start = block.size;
+            input_file.read(block.data.get() + start, block.capacity - start);
+            block.size += (size_t)input_file.gcount();
+            if (!input_file && !inputStreamOk(input_file, log)) {
+                read_failed = true;
+                at_end = true;
+                break;
+            }
+            at_end = !input_file;
+            for (const char* p = block.data.get() + block.size; p > block.data.get() + start; ) {
+                if (*--p == '\n') {
+                    last_eol = p;
+                    break;
+                }
+            }
+        }
+        if (read_failed)
+            break;
+
+        if (!at_end) {
+            const size_t whole_lines = last_eol + 1 - block.data.get();
+            partial_line.assign(block.data.get() + whole_lines, block.size - whole_lines);
+            block.size = whole_lines;
+        }
+        if (!full_blocks.push(std::move(block)))
+            break;
+    }
+    full_blocks.close();
+
+    time.total = std::chrono::duration<double>(std::chrono::steady_clock::now() - stage_start).count();
+    time.waiting = free_blocks.consumerWaitSeconds();
+}
+
+// everything the parser needs to know from one block to the next
+struct ParseState {
+    bool header_read{ false };
+    DayNumber initial_day{ 0 };
+    std::vector<DayNumber> saved_days; // in increasing order, to find duplicates
+    string last_line;                  // for duplicate date message of last day
+    bool failed{ false };
+    FileStats stats;                   // parser's counters and timers, added to the file's when it's done
+};
+
+// parses the lines of full_blocks into days, sent on in days. Messages go to log, which no other stage writes to
+void parseStage(const Options& options, SpscQueue<TextBlock>& full_blocks, SpscQueue<TextBlock>& free_blocks, SpscQueue<FinishedDay>& days,
+    SpscQueue<DayBuffer>& free_day_buffers, const bool& read_failed, ParseState& state, std::ostream& log, StageTime& time) {
+    const auto stage_start = std::chrono::steady_clock::now();
+    FileStats& stats = state.stats;
+    LineHandler handler(options, stats, log);
+    FinishedDay day;
+    free_day_buffers.pop(day.bars);
+
+    // sends a complete day to the writer and gets a new day buffer. Returns false if the date was seen before
+    auto saveDay = [&](DayNumber date, DayBuffer&) {
+        day.date = date;
+        const DayOrder order = checkDayOrder(state.saved_days, date);
+        if (order == DayOrder::duplicate)
+            return false;
+        if (order == DayOrder::out_of_order) {
+            char buffer[formatted_date_size + 1]{};
+            formatDate(date, buffer);
+            log << "***Error*** Date out of order (--pipeline requires ascending dates): " << buffer << endl;
+            state.failed = true;
+            return true;
+        }
+        state.initial_day = handler.initialDay();
+        if (!days.push(std::move(day)) || !free_day_buffers.pop(day.bars))
+            state.failed = true;
+        return true;
+    };
+    DayBufferBars day_bars(day.bars, saveDay);
+
+    TextBlock block;
+    std::string_view line;
+    while (!state.failed && full_blocks.pop(block)) {
+        const char* next = block.data.get();
+        const char* const end = next + block.size;
+
+        // read header;
+        if (!state.header_read) {
+            if (!nextLine(next, end, line)) {
+                free_blocks.push(std::move(block));
+                continue;
+            }
+            if (line != "\"Date\",\"Time\",\"Open\",\"High\",\"Low\",\"Close\",\"Up\",\"Down\"" && line != "Date,Time,Open,High,Low,Close,Up,Down")
+                log << "***Warning*** First line is not expected header:" << "Date,Time,Open,High,Low,Close,Up,Down" << endl;
+            state.header_read = true;
+        }
+
+        while (!state.failed && nextLine(next, end, line)) {
+            stats.lines++;
+            if (!handler.handle(line, day_bars)) {
+                state.failed = true;
+                break;
+            }
+        }
+        if (!line.empty())
+            state.last_line.assign(line);
+
+        // block goes back to the reader
+        free_blocks.push(std::move(block));
+    }
+
+    // save last day
+    if (read_failed) {
+        log << "***Error*** Unable to read input file." << endl;
+        state.failed = true;
+    }
+    else if (!state.failed && !state.header_read) {
+        log << "***Error*** Inout file is empty" << endl;
+        state.failed = true;
+    }
+    else if (!state.failed)
+        handler.finish(state.last_line, day_bars);
+
+    // stop the other stages if something went wrong, or tell the writer there are no more days
+    if (state.failed) {
+        full_blocks.close();
+        free_blocks.close();
+    }
+    days.close();
+
+    time.total = std::chrono::duration<double>(std::chrono::steady_clock::now() - stage_start).count();
+    time.waiting = full_blocks.consumerWaitSeconds() + free_day_buffers.consumerWaitSeconds();
+}
+
+} // namespace
+
+bool ProcessCSVFilePipelined(const Options& options, const std::filesystem::path& input_path, OutputWriter& output_file,
+    const std::filesystem::path& output_path, std::ostream& log, FileStats& stats) {
+    const auto open_start = std::chrono::steady_clock::now();
+    const Compression compression = compressionOf(input_path);
+    std::ifstream plain_file;
+    DecompressingStream compressed_file;
+    std::istream& input_file = compression != Compression::none ? (std::istream&)compressed_file : plain_file;
+    if (compression != Compression::none)
+        compressed_file.open(input_path, compression);
+    else
+        plain_file.open(input_path, std::ios::binary);
+    if (!input_file.rdbuf() || !input_file.good()) {
+        log << "***Error*** Unable to open '" << input_path << "' for reading." << endl;
+        return false;
+    }
+    stats.open_seconds += secondsSince(open_start);
+
+    // write header to output file
+    writeHeader(output_file);
+
+    DatasetWriter dataset_writer(options, output_file, stats);
+    if (!dataset_writer.open(output_path, log))
+        return false;
+
+    SpscQueue<TextBlock> free_blocks(num_blocks);
+    SpscQueue<TextBlock> full_blocks(num_blocks);
+    SpscQueue<FinishedDay> days(num_day_buffers);
+    SpscQueue<DayBuffer> free_day_buffers(num_day_buffers);
+    for (size_t i = 0; i < num_blocks; i++) {
+        TextBlock block;
+        block.grow(block_size);
+        free_blocks.push(std::move(block));
+    }
+    for (size_t i = 0; i < num_day_buffers; i++)
+        free_day_buffers.push(DayBuffer());
+
+    bool read_failed = false;
+    ParseState parse_state;
+    std::ostringstream read_log, parse_log; // written by reader and parser threads, copied to log when they're done
+    StageTime read_time, parse_time, write_time;
+    std::thread reader([&] { readStage(input_file, free_blocks, full_blocks, read_failed, read_log, read_time); });
+    std::thread parser([&] { parseStage(options, full_blocks, free_blocks, days, free_day_buffers, read_failed, parse_state, parse_log, parse_time); });
+
+    // write days as they come. The parser sets initial_day before it sends the first day
+    const auto write_start = std::chrono::steady_clock::now();
+    FinishedDay day;
+    bool started = false;
+    while (days.pop(day)) {
+        if (!started) {
+            dataset_writer.start(parse_state.initial_day);
+            started = true;
+        }
+        dataset_writer.write(day.date, day.bars);
+        free_day_buffers.push(std::move(day.bars));
+    }
+    write_time.total = std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count();
+    write_time.waiting = days.consumerWaitSeconds();
+
+    parser.join();
+    reader.join();
+    log << read_log.str() << parse_log.str();
+    if (compression != Compression::none)
+        logDecompression(compressed_file, log);
+    parse_state.stats.parse_seconds = parse_time.busy();
+    stats.add(parse_state.stats);
+    if (parse_state.failed)
+        return false;
+
+    // where the time went. The stage with the most busy time is the one the others wait for
+    const StageTime* stages[3] = { &read_time, &parse_time, &write_time };
+    const char* const stage_names[3] = { "read", "parse", "write" };
+    int bottleneck = 0;
+    for (int i = 1; i < 3; i++) {
+        if (stages[i]->busy() > stages[bottleneck]->busy())
+            bottleneck = i;
+    }
+    char message[200];
+    snprintf(message, sizeof(message), "Pipeline busy/waiting seconds: read %.3f/%.3f, parse %.3f/%.3f, write %.3f/%.3f (%s is the bottleneck)",
+        read_time.busy(), read_time.waiting, parse_time.busy(), parse_time.waiting, write_time.busy(), write_time.waiting, stage_names[bottleneck]);
+    log << message << endl;
+
+    return dataset_writer.finish(log);
+}
@@ -0,0 +1,61 @@
+//
+// ResampleLibrary.cpp : the in-process interface of ResampleLibrary.h
+//
+
+#include <iostream>
+
+#include "ResampleLibrary.h"
+
+using std::endl;
+
+bool partitionDays(const Options& options, std::span<const BarStore::Day> days, DayNumber initial_day, Partitions& partitions, std::ostream& log) {
+    for (int i = 0; i < 3; i++) {
+        partitions.days_[i].clear();
+        partitions.indexes_[i].clear();
+    }
+    if (days.empty())
+        return true;
+
+    const SharedCalendar* calendar = options.universe != nullptr ? &options.universe->calendar : nullptr;
+    if (calendar != nullptr) {
+        if (!assignDatasets(days, *calendar, partitions.indexes_, log))
+            return false;
+    }
+    else
+        assignDatasets(days, options.interval, options.ratio, 0, partitions.indexes_);
+
+    // new dates as writeOutputFile gives them
+    DayNumber next_day = initial_day;
+    for (int i = 0; i < 3; i++) {
+        partitions.days_[i].reserve(partitions.indexes_[i].size());
+        for (const uint32_t index : partitions.indexes_[i]) {
+            const BarStore::Day& day = days[index];
+            const DayNumber new_date = calendar != nullptr ? calendar->newDate(day.date) : next_day++;
+            partitions.days_[i].push_back(PartitionedDay{ day.date, new_date, day.first_bar, day.num_bars });
+        }
+    }
+    return true;
+}
+
+bool ParsedBars::loadFile(const Options& options, const std::filesystem::path& path, std::ostream& log) {
+    if (!file_.open(path)) {
+        log << "***Error*** Unable to open '" << path << "' for reading." << endl;
+        return false;
+    }
+    return loadText(options, file_.view(), log);
+}
+
+bool ParsedBars::loadText(const Options& options, std::string_view text, std::ostream& log) {
+    bars_ = BarStore();
+    owned_text_.clear();
+    stats_ = FileStats();
+    initial_day_ = 0;
+    if (!ParseCSVText(options, text, bars_, owned_text_, initial_day_, log, stats_))
+        return false;
+    bars_.sortDays();
+    if (bars_.empty()) {
+        log << "***Error*** After filtering for minimum value, input file is empty" << endl;
+        return false;
+    }
+    return true;
+}
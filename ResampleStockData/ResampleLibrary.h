@@ -0,0 +1,103 @@
+//
+// ResampleLibrary.h : resampling inside another program (link resample_core). Bars are parsed once, from a file or a
+// buffer, or come from the caller as a span of its own bars, and the data sets are handed back as views of them with
+// their new dates: nothing is copied and no _resampled.csv is written unless the caller writes one (ResampleBars does,
+// from the same Partitions)
+//
+//     ParsedBars parsed;
+//     Partitions partitions;
+//     if (parsed.loadFile(options, "AAPL.csv", log) && parsed.partition(options, partitions, log))
+//         forEachDay(partitions, parsed.bars(), [&](DatasetAssigner::Dataset dataset, const PartitionedDay& day, std::span<const BarView> bars) { ... });
+//
+
+#pragma once
+
+#include <filesystem>
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include "MappedFile.h"
+#include "ResampleStockData.h"
+
+// one day of a data set: where its bars are and the date they're moved to
+struct PartitionedDay {
+    DayNumber date;     // original date
+    DayNumber new_date;
+    uint32_t first_bar; // index of the day's first bar in the bars that were partitioned
+    uint32_t num_bars;
+};
+
+// The days of each data set, in output file order. New dates are as in the output file without --warmup: training
+// days from the initial day (the first one read) on, a day at a time, then validation, then test (or, with
+// options.universe, the shared calendar's dates)
+class Partitions {
+public:
+    const std::vector<PartitionedDay>& days(DatasetAssigner::Dataset dataset) const { return days_[dataset]; }
+    // index of each day of dataset in the day list that was partitioned, as writeOutputFile takes them
+    const std::vector<uint32_t>& dayIndexes(DatasetAssigner::Dataset dataset) const { return indexes_[dataset]; }
+
+private:
+    friend bool partitionDays(const Options& options, std::span<const BarStore::Day> days, DayNumber initial_day, Partitions& partitions, std::ostream& log);
+    std::vector<PartitionedDay> days_[3];
+    std::vector<uint32_t> indexes_[3];
+};
+
+// splits days (in date order) into data sets by options.interval and options.ratio, or by options.universe's
+// calendar. Returns false if a day isn't in that calendar
+bool partitionDays(const Options& options, std::span<const BarStore::Day> days, DayNumber initial_day, Partitions& partitions, std::ostream& log);
+
+// partitionDays for bars of the caller's own, in date order: each run of bars whose date_of(bar) is the same is a day.
+// The PartitionedDays index into bars
+template <typename Bar, typename DateOf>
+bool partitionBars(const Options& options, std::span<const Bar> bars, DateOf date_of, Partitions& partitions, std::ostream& log) {
+    std::vector<BarStore::Day> days;
+    for (uint32_t i = 0; i < (uint32_t)bars.size(); i++) {
+        const DayNumber date = date_of(bars[i]);
+        if (days.empty() || date != days.back().date) {
+            if (!days.empty() && date < days.back().date) {
+                log << "***Error*** Bars must be in date order" << std::endl;
+                return false;
+            }
+            days.push_back(BarStore::Day{ date, i, 0 });
+        }
+        days.back().num_bars++;
+    }
+    return partitionDays(options, days, days.empty() ? 0 : days.front().date, partitions, log);
+}
+
+// calls visit(dataset, day, day's bars) for every day of every data set, in output file order
+template <typename Bar, typename Visit>
+void forEachDay(const Partitions& partitions, std::span<const Bar> bars, Visit visit) {
+    for (const DatasetAssigner::Dataset dataset : { DatasetAssigner::training, DatasetAssigner::validation, DatasetAssigner::test }) {
+        for (const PartitionedDay& day : partitions.days(dataset))
+            visit(dataset, day, bars.subspan(day.first_bar, day.num_bars));
+    }
+}
+
+// The bars of a TradeStation .csv file (or of text in that format), parsed in place as ProcessMappedCSVFile parses
+// them: options.min_value, options.check_bars, options.bar_size and options.parse_threads apply. The bars are views of
+// the file, which stays mapped as long as this object, or of the caller's text, which must stay unchanged as long as
+// this object is used (bars made with options.bar_size are copies, kept by this object)
+class ParsedBars {
+public:
+    bool loadFile(const Options& options, const std::filesystem::path& path, std::ostream& log);
+    bool loadText(const Options& options, std::string_view text, std::ostream& log);
+
+    // every bar, in file order (a day's bars are bars().subspan(day.first_bar, day.num_bars))
+    std::span<const BarView> bars() const { return bars_.bars(); }
+    const BarStore& store() const { return bars_; }
+    DayNumber initialDay() const { return initial_day_; }
+    const FileStats& stats() const { return stats_; }
+
+    bool partition(const Options& options, Partitions& partitions, std::ostream& log) const {
+        return partitionDays(options, bars_.days(), initial_day_, partitions, log);
+    }
+
+private:
+    MappedFile file_;
+    BarStore bars_;
+    std::vector<TextArena> owned_text_; // bars with empty fields
+    DayNumber initial_day_{ 0 };
+    FileStats stats_;
+};
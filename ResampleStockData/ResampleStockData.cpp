@@ -5,103 +5,613 @@
 #include <iostream>
 #include <filesystem>
 #include <fstream>
-#include <map>
 #include <functional>
 #include <cassert>
+#include <string_view>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "ResampleStockData.h"
+#include "MappedFile.h"
+#include "ResampleLibrary.h"
+#include "LineHandler.h"
+#include "ThreadPool.h"
+
+#ifndef _WIN32
+#include <cstring>
+#define strtok_s strtok_r // same arguments
+#endif
 
 using std::cout;
 using std::endl;
 using std::string;
 
+// result of resampling one file
+enum class FileResult {
+    ok,
+    failed, // this file couldn't be resampled; go on to next file
+    fatal   // output file couldn't be created; don't bother with other files
+};
+
+// a run of lines with the same date within one chunk of a memory mapped file, after the minimum value filter
+struct DaySegment {
+    DayNumber date{ 0 };
+    std::string_view first_line;  // for duplicate date message
+    size_t first_bar{ 0 };        // bars of the segment are ParsedChunk::bars[first_bar, first_bar + num_bars)
+    size_t num_bars{ 0 };
+    bool cleared{ false };        // a bar below the minimum value threw away all prior bars of the day
+    bool first_bar_kept{ false }; // first bar is the bar on first_line
+};
+
+// result of parsing one chunk of a memory mapped file
+struct ParsedChunk {
+    std::vector<DaySegment> segments;
+    std::vector<BarView> bars;
+    TextArena owned_text{ 64 * 1024 }; // text of bars with empty fields, which therefore can't be a view of the line
+    std::string_view last_line;
+    string error;                      // error message, if parsing stopped at an invalid line
+    string warnings;                   // bars skipped by --check-bars
+    FileStats stats;                   // lines, date conversion and filter times of this chunk
+};
+
+// a chunk's bars, for LineHandler. Each day it starts is a new segment; whether a date was seen before is only known
+// once the chunks are merged
+class ChunkBars {
+public:
+    ChunkBars(ParsedChunk& chunk, std::ostream& errors) : chunk_(chunk), errors_(errors) {}
+
+    bool endDay() { return true; }
+    bool beginDay(DayNumber date, std::string_view line) {
+        DaySegment& segment = chunk_.segments.emplace_back();
+        segment.date = date;
+        segment.first_line = line;
+        segment.first_bar = chunk_.bars.size();
+        return true;
+    }
+    void clearDay() {
+        DaySegment& segment = chunk_.segments.back();
+        chunk_.bars.resize(segment.first_bar);
+        segment.num_bars = 0;
+        segment.cleared = true;
+        segment.first_bar_kept = false;
+    }
+    bool addBar(std::string_view line, const std::string_view* fields) {
+        // date,time,open,...,down is normally one slice of the line. If there were empty fields (which splitView skips),
+        // build the text without them
+        const char* text = fields[0].data();
+        size_t values_size = 5; // 5 separating commas
+        for (int i = 2; i < 8; i++)
+            values_size += fields[i].size();
+        if (!BarView::fits(fields[0].size(), fields[1].size(), values_size)) {
+            errors_ << "***Error*** Line is too long: " << line << endl;
+            return false;
+        }
+
+        if (fields[7].data() + fields[7].size() - text != (ptrdiff_t)(fields[0].size() + 1 + fields[1].size() + 1 + values_size)) {
+            char* owned = chunk_.owned_text.allocate(fields[0].size() + 1 + fields[1].size() + 1 + values_size);
+            text = owned;
+            for (int i = 0; i < 8; i++) {
+                if (i > 0)
+                    *owned++ = ',';
+                memcpy(owned, fields[i].data(), fields[i].size());
+                owned += fields[i].size();
+            }
+        }
+        DaySegment& segment = chunk_.segments.back();
+        if (line.data() == segment.first_line.data())
+            segment.first_bar_kept = true;
+        chunk_.bars.push_back(BarView(text, fields[0].size(), fields[1].size(), values_size));
+        segment.num_bars++;
+        return true;
+    }
+    // a coarser bar's first bar is never skipped as the first bar after a duplicate day is (first_bar_kept stays false)
+    void addAggregated(const BarAggregator& aggregator) {
+        chunk_.bars.push_back(aggregator.copyTo(chunk_.owned_text));
+        chunk_.segments.back().num_bars++;
+    }
+
+private:
+    ParsedChunk& chunk_;
+    std::ostream& errors_;
+};
+
 // forward declarations
-bool ProcessCommandLine(int argc, const char* argv[], std::filesystem::path& directory, char& interval, std::vector<int>& ratio, float& min_value);
-bool ProcessCSVFile(char interval, std::vector<int> ratio, float min_value, std::ifstream& input_file, std::ofstream& output_file);
-bool DateStringsToTime_t(const string& line, const string& date, std::time_t& t);
-std::vector<string> split(const string& line, const char* delimiter);
+bool ProcessCommandLine(int argc, const char* argv[], Options& options);
+bool parseSplit(std::string_view spec, SplitConfig& split);
+FileResult ResampleFile(const Options& options, const std::filesystem::path& input_path, std::ostream& log, FileStats& stats);
+bool ResampleFilesInParallel(const Options& options, const std::vector<std::filesystem::directory_entry>& file_list, std::vector<FileStats>& file_stats);
+uint64_t EstimateFileMemory(uint64_t file_size, const Options& options);
+bool ProcessCSVFile(const Options& options, std::istream& input_file, OutputWriter& output_file, std::ostream& log, FileStats& stats);
+void ParseChunk(const Options& options, std::string_view text, ParsedChunk& chunk);
+const char* nextDateChange(const char* begin, const char* line, const char* end);
 int dayOfWeek(int day, int month, int year);
-int weekNumber(time_t t);
-int weekNumber(int start_week_number, time_t curDate);
-int monthNumber(time_t t);
-int monthNumber(int start_month_number, time_t curDate);
-bool checkPeriod(std::function<int(int, const time_t)> periodNumberFunc, int start_period_number, const time_t cur_time, int cur_period);
-time_t writeOutputFile(std::ofstream& output_file, const std::vector<std::vector<string>>& days, time_t initial_time_t, const string& dataset_name);
-
-constexpr int seconds_in_day = 24 * 60 * 60;
+bool checkPeriod(std::function<int(int, const DayNumber)> periodNumberFunc, int start_period_number, const DayNumber cur_day, int cur_period);
 
+// the benchmark (see CMakeLists.txt) links everything in here except main
+#ifndef RESAMPLE_NO_MAIN
 int main(int argc, const char* argv[])
 {
     // process command line arguments;
-    std::filesystem::path directory;
-    char interval;
-    std::vector<int> ratio;
-    float min_value = 1.0f;
-    bool rc = ProcessCommandLine(argc, argv, directory, interval, ratio, min_value);
+    Options options;
+    bool rc = ProcessCommandLine(argc, argv, options);
     if (!rc)
         return -1;
+    const auto run_start = std::chrono::steady_clock::now();
 
-    // process each file in directory
-    int file_count = 0;
-    std::vector<std::string> file_list;
-    for (const auto& entry : std::filesystem::directory_iterator(directory))
+    // find all .csv (and .csv.gz and .csv.zst) files in directory
+    std::vector<std::filesystem::directory_entry> file_list;
+    for (const auto& entry : std::filesystem::directory_iterator(options.directory))
     {
-        const auto full_name = entry.path().string();
-        if (entry.is_regular_file())
-        {
-            if (!full_name.ends_with(".csv"))
-                continue;
-            const string input_filename = entry.path().filename().string();
-            file_count++;
-
-            // open input file
-            std::ifstream csv_file(entry.path());
-            // Make sure the file is open
-            if (!csv_file.is_open() || !csv_file.good()) {
-                cout << "***Error*** Unable to open '" << entry.path() << "' for reading." << endl;
-                continue;
-            }
-
-            // if necessary, create output directory ResampledData, then create output file
-            std::filesystem::path output_directory = entry.path().parent_path().concat("/ResampledData/");
-            if (!std::filesystem::exists(output_directory)) {
-                // create output directory
-                if (!std::filesystem::create_directory(output_directory)) {
-                    cout << "***Error*** Unable to create output directory '" << output_directory << "'" << endl;
-                    return -1;;
-                }
-                cout << "Created output directory '" << output_directory << "'" << endl;
-            }
-            const string output_filename = input_filename.substr(0, input_filename.size() - 4) + "_resampled.csv";
-            string full_output_filename = entry.path().parent_path().string() + "/ResampledData/" + input_filename.substr(0, input_filename.size() - 4) + "_resampled.csv";
-            std::ofstream resampled_csv_file(full_output_filename);
-            // if we can't create an output file, we quit, because we probably can't create any other output files either
-            if (!resampled_csv_file.is_open() || !resampled_csv_file.good()) {
-                cout << "***Error*** Unable to create '" << full_output_filename << "' for writing. It might be locked by another program." << endl;
+        if (entry.is_regular_file() && isCsvFile(entry.path()))
+            file_list.push_back(entry);
+    }
+    // a watched directory may be empty to start with
+    if (file_list.empty() && !options.watch) {
+        cout << "***Error*** No valid .csv files found in specified directory" << endl;
+        return -1;
+    }
+    // with --sort, the parts of a file are resampled together, so list just one of them
+    if (options.sort) {
+        std::vector<string> stems;
+        std::erase_if(file_list, [&](const std::filesystem::directory_entry& entry) {
+            const string stem = inputStem(entry.path());
+            if (std::find(stems.begin(), stems.end(), stem) != stems.end())
+                return true;
+            stems.push_back(stem);
+            return false;
+        });
+    }
+    // otherwise, e.g. a.csv and a.csv.gz would both be resampled to a_resampled.csv
+    else {
+        std::vector<string> stems;
+        for (const auto& entry : file_list) {
+            const string stem = csvStem(entry.path());
+            if (std::find(stems.begin(), stems.end(), stem) != stems.end()) {
+                cout << "***Error*** More than one input file would be resampled to '" << stem << "_resampled.csv'; remove all but one of them (or use --sort to resample them together)" << endl;
                 return -1;
             }
+            stems.push_back(stem);
+        }
+    }
 
-            // now process input file to output file
-            cout << endl << "Resampling '" << input_filename << "' to create '" << output_filename << endl;
-            if (!ProcessCSVFile(interval, ratio, min_value, csv_file, resampled_csv_file))
-                continue;
+    // if necessary, create output directory ResampledData
+    std::filesystem::path output_directory = (file_list.empty() ? options.directory : file_list.front().path().parent_path()).concat("/ResampledData/");
+    if (!std::filesystem::exists(output_directory)) {
+        // create output directory
+        if (!std::filesystem::create_directory(output_directory)) {
+            cout << "***Error*** Unable to create output directory '" << output_directory << "'" << endl;
+            return -1;;
         }
+        cout << "Created output directory '" << output_directory << "'" << endl;
     }
-    if (file_count == 0) {
-        cout << "***Error*** No valid .csv files found in specified directory" << endl;
+
+    if (options.watch) {
+        std::vector<std::filesystem::path> paths;
+        for (const auto& entry : file_list)
+            paths.push_back(entry.path());
+        return WatchDirectory(options, paths) ? 0 : -1;
+    }
+
+    // one calendar for all the files, before any of them is resampled
+    if (options.shared_calendar) {
+        std::vector<std::filesystem::path> paths;
+        for (const auto& entry : file_list)
+            paths.push_back(entry.path());
+        options.universe = BuildUniverse(options, paths, cout);
+        if (options.universe == nullptr)
+            return -1;
+    }
+
+    // process each file in directory
+    std::vector<FileStats> file_stats;
+    int exit_code = 0;
+    if (options.num_threads > 1)
+        exit_code = ResampleFilesInParallel(options, file_list, file_stats) ? 0 : -1;
+    else {
+        for (const auto& entry : file_list) {
+            // if we can't create an output file, we quit, because we probably can't create any other output files either
+            if (ResampleFile(options, entry.path(), cout, file_stats.emplace_back()) == FileResult::fatal) {
+                exit_code = -1;
+                break;
+            }
+        }
+    }
+
+    std::erase_if(file_stats, [](const FileStats& stats) { return stats.file.empty(); }); // not started, after a fatal error
+    if (!options.stats_path.empty() && !WriteStatsFile(options.stats_path, file_stats, secondsSince(run_start))) {
+        cout << "***Error*** Unable to write stats file '" << options.stats_path.string() << "'" << endl;
         return -1;
     }
+    return exit_code;
+}
+#endif
 
-    return 0;
+// resamples one .csv file into ResampledData/<name>_resampled.csv. All messages about this file are written to log,
+// and its timers and counters to stats
+FileResult ResampleFile(const Options& options, const std::filesystem::path& input_path, std::ostream& log, FileStats& stats) {
+    const string input_filename = input_path.filename().string();
+    const auto file_start = std::chrono::steady_clock::now();
+    uint64_t allocations_start = 0;
+    const bool allocations_counted = allocationCount(allocations_start);
+    stats.file = input_filename;
+    auto finish = [&](FileResult result) {
+        stats.ok = result == FileResult::ok;
+        stats.total_seconds = secondsSince(file_start);
+        stats.peak_memory = peakMemory();
+        // other files' allocations would be counted too
+        uint64_t allocations_end = 0;
+        stats.allocations = options.num_threads > 1 || !allocations_counted || !allocationCount(allocations_end) ? -1 : (int64_t)(allocations_end - allocations_start);
+        return result;
+    };
+    std::error_code ec;
+    std::vector<std::filesystem::path> parts; // --sort: the file and its parts
+    if (options.sort) {
+        parts = findParts(input_path);
+        for (const std::filesystem::path& part : parts)
+            stats.bytes_read += std::filesystem::file_size(part, ec);
+    }
+    else if (!options.incremental)
+        stats.bytes_read = std::filesystem::file_size(input_path, ec);
+
+    // a compressed file can't be mapped, so it's read as a stream (decompressed on a thread of its own) in every mode
+    // that reads a line at a time. The cache and incremental modes need the file itself
+    const Compression compression = compressionOf(input_path);
+    if (!compressionSupported(compression)) {
+        log << "***Error*** This build can't read " << compressionName(compression) << " files, so '" << input_filename << "' was skipped" << endl;
+        return finish(FileResult::failed);
+    }
+    if (compression != Compression::none && (options.cache || options.incremental)) {
+        log << "***Error*** --cache and --incremental can't read compressed files, so '" << input_filename << "' was skipped" << endl;
+        return finish(FileResult::failed);
+    }
+
+    // open input file (in mmap, streaming, pipeline and cache mode, the file is opened by the function that processes it)
+    std::ifstream csv_file;
+    DecompressingStream compressed_file;
+    std::istream& input_file = compression != Compression::none ? (std::istream&)compressed_file : csv_file;
+    const bool read_as_stream = options.io_mode == IOMode::stream || compression != Compression::none;
+    if (read_as_stream && !options.streaming && !options.pipeline && !options.cache && !options.incremental && !options.sort) {
+        if (compression != Compression::none)
+            compressed_file.open(input_path, compression);
+        else
+            csv_file.open(input_path);
+        // Make sure the file is open
+        if (!input_file.rdbuf() || !input_file.good()) {
+            log << "***Error*** Unable to open '" << input_path << "' for reading." << endl;
+            return finish(FileResult::failed);
+        }
+    }
+
+    // create output file (incremental mode replaces it when it's done)
+    const string output_filename = (options.sort ? inputStem(input_path) : csvStem(input_path)) + "_resampled.csv" + compressionExtension(options.output_compression);
+    string full_output_filename = input_path.parent_path().string() + "/ResampledData/" + output_filename;
+    if (options.incremental) {
+        log << endl << "Resampling '" << input_filename << "' to update '" << output_filename << endl;
+        return finish(ProcessCSVFileIncremental(options, input_path, full_output_filename, log, stats) ? FileResult::ok : FileResult::failed);
+    }
+    OutputWriter resampled_csv_file(output_buffer_size, options.gather_writes);
+    if (!resampled_csv_file.open(full_output_filename, options.output_compression, options.replace_outputs)) {
+        log << "***Error*** Unable to create '" << full_output_filename << "' for writing. It might be locked by another program." << endl;
+        return finish(FileResult::fatal);
+    }
+    stats.open_seconds = secondsSince(file_start);
+
+    // now process input file to output file
+    if (options.sort && parts.size() > 1) {
+        log << endl << "Resampling " << parts.size() << " files (";
+        for (size_t i = 0; i < parts.size(); i++)
+            log << (i > 0 ? ", '" : "'") << parts[i].filename().string() << "'";
+        log << ") to create '" << output_filename << endl;
+    }
+    else
+        log << endl << "Resampling '" << input_filename << "' to create '" << output_filename << endl;
+    bool rc;
+    if (options.sort)
+        rc = ProcessCSVFilesSorted(options, parts, resampled_csv_file, full_output_filename, log, stats);
+    else if (options.streaming)
+        rc = ProcessCSVFileStreaming(options, input_path, resampled_csv_file, full_output_filename, log, stats);
+    else if (options.pipeline)
+        rc = ProcessCSVFilePipelined(options, input_path, resampled_csv_file, full_output_filename, log, stats);
+    else if (options.cache) {
+        const string cache_filename = input_path.parent_path().string() + "/ResampledData/" + csvStem(input_path) + ".rsbin";
+        rc = ProcessCachedCSVFile(options, input_path, cache_filename, resampled_csv_file, log, stats);
+    }
+    else if (!read_as_stream)
+        rc = ProcessMappedCSVFile(options, input_path, resampled_csv_file, log, stats);
+    else {
+        rc = ProcessCSVFile(options, input_file, resampled_csv_file, log, stats);
+        if (compression != Compression::none)
+            logDecompression(compressed_file, log);
+    }
+    stats.bytes_written += resampled_csv_file.bytesWritten();
+    return finish(rc ? FileResult::ok : FileResult::failed);
+}
+
+// rough estimate of the memory held while a file of the given size is being resampled: the file itself (mapped or as
+// bar strings) plus the per bar bookkeeping (a BarView, or the string and vector overhead of a bar string). Streaming
+// only holds one day, so it's just the output and spill file buffers; a pipeline holds a few blocks and days too. A
+// cache file is about twice the size of its input file, which is mapped too. Sorting stays within its memory limit
+uint64_t EstimateFileMemory(uint64_t file_size, const Options& options) {
+    if (options.sort)
+        return (uint64_t)options.sort_memory_mb * 1024 * 1024 + output_buffer_size + 1024 * 1024;
+    if (options.streaming)
+        return output_buffer_size + 1024 * 1024;
+    if (options.pipeline)
+        return output_buffer_size + 8 * 1024 * 1024;
+    if (options.cache)
+        return 4 * file_size;
+    return options.io_mode == IOMode::mmap ? 2 * file_size : 4 * file_size;
+}
+
+// resamples the files on options.num_threads threads, largest file first, so that the run doesn't end with one thread
+// working through a big file while the others sit idle. A file isn't started while doing so would push the
+// estimated memory of the files in progress above options.max_memory_mb (unless nothing else is in progress).
+// Each file's messages are collected and written to cout as one block when the file is finished. Each file's stats go
+// to file_stats, in the order the files were started
+bool ResampleFilesInParallel(const Options& options, const std::vector<std::filesystem::directory_entry>& file_list, std::vector<FileStats>& file_stats) {
+    struct Job {
+        std::filesystem::path path;
+        uint64_t memory;
+    };
+    std::vector<Job> jobs;
+    for (const auto& entry : file_list) {
+        // text is roughly 8 times the size of a compressed file of it
+        const uint64_t text_size = compressionOf(entry.path()) != Compression::none ? 8 * entry.file_size() : entry.file_size();
+        jobs.push_back(Job{ entry.path(), EstimateFileMemory(text_size, options) });
+    }
+    std::stable_sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.memory > b.memory; });
+
+    const uint64_t max_memory = (uint64_t)options.max_memory_mb * 1024 * 1024;
+    std::mutex memory_mutex;
+    std::condition_variable memory_released;
+    uint64_t memory_in_use = 0;
+
+    std::mutex cout_mutex;
+    std::atomic<bool> fatal_error{ false };
+    file_stats.resize(jobs.size());
+
+    cout << "Resampling " << jobs.size() << " files on " << options.num_threads << " threads" << endl;
+    {
+        ThreadPool pool(options.num_threads);
+        for (size_t i = 0; i < jobs.size(); i++) {
+            const Job& job = jobs[i];
+            pool.submit([&, job, i] {
+                // if we couldn't create an output file, we probably can't create any other output files either
+                if (fatal_error)
+                    return;
+
+                if (max_memory > 0) {
+                    std::unique_lock<std::mutex> lock(memory_mutex);
+                    memory_released.wait(lock, [&] { return memory_in_use == 0 || memory_in_use + job.memory <= max_memory; });
+                    memory_in_use += job.memory;
+                }
+
+                std::ostringstream log;
+                if (ResampleFile(options, job.path, log, file_stats[i]) == FileResult::fatal)
+                    fatal_error = true;
+
+                if (max_memory > 0) {
+                    {
+                        std::lock_guard<std::mutex> lock(memory_mutex);
+                        memory_in_use -= job.memory;
+                    }
+                    memory_released.notify_all();
+                }
+
+                std::lock_guard<std::mutex> lock(cout_mutex);
+                cout << log.str() << std::flush;
+            });
+        }
+        pool.wait();
+    }
+
+    return !fatal_error;
 }
 
-bool ProcessCommandLine(int argc, const char* argv[], std::filesystem::path& directory, char& interval, std::vector<int>& ratio, float& min_value) {
+bool ProcessCommandLine(int argc, const char* argv[], Options& options) {
     bool directorySpecified = false;
     bool intervalIsSpecified = false;
     bool ratioIsSpecified = false;
     bool minIsSpecified = false;
+    bool ioIsSpecified = false;
+    bool jobsIsSpecified = false;
+    bool maxMemoryIsSpecified = false;
+    bool warmupIsSpecified = false;
+    bool sortMemoryIsSpecified = false;
+    bool parseThreadsIsSpecified = false;
+    bool watchMemoryIsSpecified = false;
+    bool watchDebounceIsSpecified = false;
+    bool barSizeIsSpecified = false;
+
+    std::filesystem::path& directory = options.directory;
+    std::vector<int>& ratio = options.ratio;
+    float& min_value = options.min_value;
 
     for (int i = 1; i < argc; i += 2) {
         const string parm(argv[i]);
-        if (parm == "-d" || parm == "--directory") {
+        // options of the form --name=value have no separate value argument
+        if (parm.starts_with("--io=")) {
+            if (ioIsSpecified)
+            {
+                cout << "***Error*** io specified more than once." << endl;
+                return false;
+            }
+            ioIsSpecified = true;
+
+            const string mode = parm.substr(5);
+            if (mode == "mmap")
+                options.io_mode = IOMode::mmap;
+            else if (mode == "stream")
+                options.io_mode = IOMode::stream;
+            else {
+                cout << "***Error*** Invalid io mode. Must be mmap or stream" << endl;
+                return false;
+            }
+            i--;
+        }
+        else if (parm.starts_with("--compress-output=")) {
+            const string format = parm.substr(18);
+            if (format == "gz")
+                options.output_compression = Compression::gzip;
+            else if (format == "zst")
+                options.output_compression = Compression::zstd;
+            else {
+                cout << "***Error*** Invalid output compression. Must be gz or zst" << endl;
+                return false;
+            }
+            if (!compressionSupported(options.output_compression)) {
+                cout << "***Error*** This build can't write " << compressionName(options.output_compression) << " files" << endl;
+                return false;
+            }
+            i--; // no value
+        }
+        else if (parm == "--writev") {
+            options.gather_writes = true;
+#ifdef _WIN32
+            cout << "***Warning*** --writev is not supported on Windows; bar text will be copied to output buffer" << endl;
+#endif
+            i--; // no value
+        }
+        else if (parm == "-s" || parm == "--streaming") {
+            options.streaming = true;
+            i--; // no value
+        }
+        else if (parm == "--pipeline") {
+            options.pipeline = true;
+            i--; // no value
+        }
+        else if (parm == "--stats") {
+            if (i + 1 >= argc) {
+                cout << "***Error*** No file name specified after --stats" << endl;
+                return false;
+            }
+            options.stats_path = argv[i + 1];
+            cout << "stats file = " << options.stats_path.string() << endl;
+        }
+        else if (parm == "--check-bars") {
+            options.check_bars = true;
+            i--; // no value
+        }
+        else if (parm == "--universe") {
+            options.shared_calendar = true;
+            i--; // no value
+        }
+        else if (parm == "--bar-size") {
+            if (barSizeIsSpecified)
+            {
+                cout << "***Error*** bar size specified more than once." << endl;
+                return false;
+            }
+            barSizeIsSpecified = true;
+
+            if (i + 1 < argc) {
+                if (!parseBarSize(argv[i + 1], options.bar_size)) {
+                    cout << "***Error*** Invalid bar size. Must be a number of minutes (1 to 1440) or session" << endl;
+                    return false;
+                }
+                cout << "bar size = " << argv[i + 1] << endl;
+            }
+            else {
+                cout << "***Error*** No bar size (minutes or session) specified after --bar-size" << endl;
+                return false;
+            }
+        }
+        else if (parm == "--watch") {
+            options.watch = true;
+            i--; // no value
+        }
+        else if (parm == "--watch-memory") {
+            if (watchMemoryIsSpecified)
+            {
+                cout << "***Error*** watch memory specified more than once." << endl;
+                return false;
+            }
+            watchMemoryIsSpecified = true;
+
+            if (i + 1 < argc) {
+                string mb{ argv[i + 1] };
+                if (mb.empty() || mb.find_first_not_of("0123456789") != string::npos || mb.size() > 7) {
+                    cout << "***Error*** Invalid watch memory (in MB)" << endl;
+                    return false;
+                }
+                options.watch_memory_mb = (unsigned)atoi(mb.c_str());
+                cout << "watch memory = " << options.watch_memory_mb << " MB" << endl;
+            }
+            else {
+                cout << "***Error*** No watch memory (in MB) specified after --watch-memory" << endl;
+                return false;
+            }
+        }
+        else if (parm == "--watch-debounce") {
+            if (watchDebounceIsSpecified)
+            {
+                cout << "***Error*** watch debounce specified more than once." << endl;
+                return false;
+            }
+            watchDebounceIsSpecified = true;
+
+            if (i + 1 < argc) {
+                string ms{ argv[i + 1] };
+                if (ms.empty() || ms.find_first_not_of("0123456789") != string::npos || ms.size() > 6) {
+                    cout << "***Error*** Invalid watch debounce (in milliseconds)" << endl;
+                    return false;
+                }
+                options.watch_debounce_ms = (unsigned)atoi(ms.c_str());
+                cout << "watch debounce = " << options.watch_debounce_ms << " ms" << endl;
+            }
+            else {
+                cout << "***Error*** No watch debounce (in milliseconds) specified after --watch-debounce" << endl;
+                return false;
+            }
+        }
+        else if (parm == "--cache") {
+            options.cache = true;
+            i--; // no value
+        }
+        else if (parm == "--splits") {
+            if (!options.splits.empty())
+            {
+                cout << "***Error*** splits specified more than once." << endl;
+                return false;
+            }
+            if (i + 1 >= argc) {
+                cout << "***Error*** No splits (interval:train#:valid#:test#[@offset],...) specified after --splits" << endl;
+                return false;
+            }
+            std::string_view specs(argv[i + 1]);
+            while (!specs.empty()) {
+                const size_t comma = specs.find(',');
+                SplitConfig split;
+                if (!parseSplit(specs.substr(0, comma), split)) {
+                    cout << "***Error*** Invalid split '" << specs.substr(0, comma) << "'. Must be interval:train#:valid#:test#[@offset], e.g. w:3:2:1@5" << endl;
+                    return false;
+                }
+                options.splits.push_back(split);
+                specs = comma == std::string_view::npos ? std::string_view() : specs.substr(comma + 1);
+            }
+            if (options.splits.empty()) {
+                cout << "***Error*** No splits specified after --splits" << endl;
+                return false;
+            }
+            cout << "splits = " << argv[i + 1] << endl;
+        }
+        else if (parm == "--split-files=csv" || parm == "--split-files=index") {
+            options.split_index = parm == "--split-files=index";
+            i--; // no value
+        }
+        else if (parm == "--incremental") {
+            options.incremental = true;
+            i--; // no value
+        }
+        else if (parm == "--verify") {
+            options.verify = true;
+            i--; // no value
+        }
+        else if (parm == "-d" || parm == "--directory") {
             if (directorySpecified)
             {
                 cout << "***Error*** directory specified more than once." << endl;
@@ -134,14 +644,13 @@ bool ProcessCommandLine(int argc, const char* argv[], std::filesystem::path& dir
             intervalIsSpecified = true;
 
             if (i + 1 < argc) {
-                if (strlen(argv[i + 1]) != 1 || (*argv[i + 1] != 'd' && *argv[i + 1] != 'w' && *argv[i + 1] != 'm')) {
-                    cout << "***Error*** Invalid interval. Must be d, w, or m" << endl;
+                if (!parseInterval(argv[i + 1], options.interval)) {
+                    cout << "***Error*** Invalid interval. Must be d, Nd (N trading days), w, w-mon (or another day the week starts on), m, q, or y" << endl;
                     return false;
                 }
-                interval = *argv[i + 1];
             }
             else {
-                cout << "***Error*** No interval (d, w, or m) specified after -i" << endl;
+                cout << "***Error*** No interval (d, Nd, w, w-day, m, q, or y) specified after -i" << endl;
                 return false;
             }
         }
@@ -219,113 +728,492 @@ bool ProcessCommandLine(int argc, const char* argv[], std::filesystem::path& dir
             }
 
         }
+        else if (parm == "-j" || parm == "--jobs") {
+            if (jobsIsSpecified)
+            {
+                cout << "***Error*** jobs specified more than once." << endl;
+                return false;
+            }
+            jobsIsSpecified = true;
+
+            if (i + 1 < argc) {
+                string jobs{ argv[i + 1] };
+                if (jobs.empty() || jobs.find_first_not_of("0123456789") != string::npos || jobs.size() > 4) {
+                    cout << "***Error*** Invalid number of jobs" << endl;
+                    return false;
+                }
+                // 0 means one job per hardware thread
+                options.num_threads = (unsigned)atoi(jobs.c_str());
+                if (options.num_threads == 0)
+                    options.num_threads = std::max(1u, std::thread::hardware_concurrency());
+                cout << "jobs = " << options.num_threads << endl;
+            }
+            else {
+                cout << "***Error*** No number of jobs specified after -j" << endl;
+                return false;
+            }
+        }
+        else if (parm == "-p" || parm == "--parse-threads") {
+            if (parseThreadsIsSpecified)
+            {
+                cout << "***Error*** parse threads specified more than once." << endl;
+                return false;
+            }
+            parseThreadsIsSpecified = true;
+
+            if (i + 1 < argc) {
+                string threads{ argv[i + 1] };
+                if (threads.empty() || threads.find_first_not_of("0123456789") != string::npos || threads.size() > 4) {
+                    cout << "***Error*** Invalid number of parse threads" << endl;
+                    return false;
+                }
+                // 0 means one thread per hardware thread
+                options.parse_threads = (unsigned)atoi(threads.c_str());
+                if (options.parse_threads == 0)
+                    options.parse_threads = std::max(1u, std::thread::hardware_concurrency());
+                cout << "parse threads = " << options.parse_threads << endl;
+            }
+            else {
+                cout << "***Error*** No number of parse threads specified after -p" << endl;
+                return false;
+            }
+        }
+        else if (parm == "--sort") {
+            options.sort = true;
+            i--; // no value
+        }
+        else if (parm == "--sort-memory") {
+            if (sortMemoryIsSpecified)
+            {
+                cout << "***Error*** sort memory specified more than once." << endl;
+                return false;
+            }
+            sortMemoryIsSpecified = true;
+
+            if (i + 1 < argc) {
+                string mb{ argv[i + 1] };
+                if (mb.empty() || mb.find_first_not_of("0123456789") != string::npos || mb.size() > 6 || atoi(mb.c_str()) == 0) {
+                    cout << "***Error*** Invalid sort memory (in MB, at least 1)" << endl;
+                    return false;
+                }
+                options.sort_memory_mb = (unsigned)atoi(mb.c_str());
+                cout << "sort memory = " << options.sort_memory_mb << " MB" << endl;
+            }
+            else {
+                cout << "***Error*** No sort memory (in MB) specified after --sort-memory" << endl;
+                return false;
+            }
+        }
+        else if (parm == "--warmup") {
+            if (warmupIsSpecified)
+            {
+                cout << "***Error*** warm-up bars specified more than once." << endl;
+                return false;
+            }
+            warmupIsSpecified = true;
+
+            if (i + 1 < argc) {
+                string count{ argv[i + 1] };
+                if (count.empty() || count.find_first_not_of("0123456789") != string::npos || count.size() > 7) {
+                    cout << "***Error*** Invalid number of warm-up bars" << endl;
+                    return false;
+                }
+                options.warmup_bars = (unsigned)atoi(count.c_str());
+                cout << "warm-up bars = " << options.warmup_bars << endl;
+            }
+            else {
+                cout << "***Error*** No number of warm-up bars specified after --warmup" << endl;
+                return false;
+            }
+        }
+        else if (parm == "--max-memory") {
+            if (maxMemoryIsSpecified)
+            {
+                cout << "***Error*** max memory specified more than once." << endl;
+                return false;
+            }
+            maxMemoryIsSpecified = true;
+
+            if (i + 1 < argc) {
+                string mb{ argv[i + 1] };
+                if (mb.empty() || mb.find_first_not_of("0123456789") != string::npos || mb.size() > 7) {
+                    cout << "***Error*** Invalid max memory (in MB)" << endl;
+                    return false;
+                }
+                options.max_memory_mb = (unsigned)atoi(mb.c_str());
+                cout << "max memory = " << options.max_memory_mb << " MB" << endl;
+            }
+            else {
+                cout << "***Error*** No max memory (in MB) specified after --max-memory" << endl;
+                return false;
+            }
+        }
         else {
             cout << "'" << parm << "' is not a recognized parameter. Try ResampleStockData.cpp -h...but not yet" << endl;
             return false;
         }
     }
 
+    if (options.parse_threads > 1 && options.io_mode != IOMode::mmap) {
+        cout << "***Error*** Parse threads (-p) require --io=mmap" << endl;
+        return false;
+    }
+    if (options.parse_threads > 1 && options.streaming) {
+        cout << "***Error*** Parse threads (-p) can't be used with streaming (-s)" << endl;
+        return false;
+    }
+    if (options.pipeline && (options.streaming || options.parse_threads > 1 || options.cache || options.incremental || !options.splits.empty())) {
+        cout << "***Error*** --pipeline can't be used with streaming (-s), -p, --cache, --incremental or --splits" << endl;
+        return false;
+    }
+    if (options.cache && options.streaming) {
+        cout << "***Error*** --cache can't be used with streaming (-s)" << endl;
+        return false;
+    }
+    if (options.cache && options.check_bars) {
+        cout << "***Error*** --cache can't be used with --check-bars" << endl;
+        return false;
+    }
+    if (options.incremental && (options.streaming || options.cache)) {
+        cout << "***Error*** --incremental can't be used with streaming (-s) or --cache" << endl;
+        return false;
+    }
+    if (options.verify && !options.incremental) {
+        cout << "***Error*** --verify requires --incremental" << endl;
+        return false;
+    }
+    if (!options.splits.empty() && (options.streaming || options.incremental)) {
+        cout << "***Error*** --splits can't be used with streaming (-s) or --incremental" << endl;
+        return false;
+    }
+    if (options.sort && (options.streaming || options.pipeline || options.parse_threads > 1 || options.cache || options.incremental ||
+        !options.splits.empty() || options.warmup_bars > 0)) {
+        cout << "***Error*** --sort can't be used with streaming (-s), --pipeline, -p, --cache, --incremental, --splits or --warmup" << endl;
+        return false;
+    }
+    if (options.output_compression != Compression::none && options.incremental) {
+        cout << "***Error*** --compress-output can't be used with --incremental" << endl;
+        return false;
+    }
+    if (sortMemoryIsSpecified && !options.sort) {
+        cout << "***Error*** --sort-memory requires --sort" << endl;
+        return false;
+    }
+    if (options.warmup_bars > 0 && (options.streaming || options.pipeline || options.incremental)) {
+        cout << "***Error*** --warmup can't be used with streaming (-s), --pipeline or --incremental" << endl;
+        return false;
+    }
+    if (options.shared_calendar && (options.streaming || options.pipeline || options.incremental || options.sort || options.warmup_bars > 0)) {
+        cout << "***Error*** --universe can't be used with streaming (-s), --pipeline, --incremental, --sort or --warmup" << endl;
+        return false;
+    }
+    if (options.watch && (options.streaming || options.pipeline || options.cache || options.incremental || options.sort || options.shared_calendar ||
+        options.io_mode != IOMode::mmap || !options.stats_path.empty())) {
+        cout << "***Error*** --watch can't be used with streaming (-s), --pipeline, --cache, --incremental, --sort, --universe, --io=stream or --stats" << endl;
+        return false;
+    }
+    if ((watchMemoryIsSpecified || watchDebounceIsSpecified) && !options.watch) {
+        cout << "***Error*** --watch-memory and --watch-debounce require --watch" << endl;
+        return false;
+    }
+    if (options.bar_size.aggregating() && options.cache) {
+        cout << "***Error*** --bar-size can't be used with --cache" << endl;
+        return false;
+    }
+    // output files are replaced while others might be reading them
+    options.replace_outputs = options.watch;
+
+    return true;
+}
+
+// parses one split of --splits: interval:train#:valid#:test#, optionally followed by @offset. Same rules as -i and -r
+bool parseSplit(std::string_view spec, SplitConfig& split) {
+    const size_t at = spec.find('@');
+    if (at != std::string_view::npos) {
+        const std::string_view offset = spec.substr(at + 1);
+        if (offset.empty() || offset.size() > 3 || offset.find_first_not_of("0123456789") != std::string_view::npos)
+            return false;
+        split.offset = atoi(string(offset).c_str());
+        spec = spec.substr(0, at);
+    }
+
+    std::string_view fields[4];
+    if (splitView(spec, ':', fields, 4) != 4 || spec.find("::") != std::string_view::npos || spec.front() == ':' || spec.back() == ':')
+        return false;
+    if (!parseInterval(fields[0], split.interval))
+        return false;
+    for (int i = 1; i < 4; i++) {
+        if (fields[i].size() != 1 || fields[i][0] < '0' || fields[i][0] > '9' || (fields[i][0] == '0' && i < 3))
+            return false;
+        split.ratio.push_back(fields[i][0] - '0');
+    }
     return true;
 }
 
-bool ProcessCSVFile(char interval, std::vector<int> ratio, float min_value, std::ifstream& input_file, std::ofstream& output_file) {
-    time_t t;
+bool ProcessCSVFile(const Options& options, std::istream& input_file, OutputWriter& output_file, std::ostream& log, FileStats& stats) {
     string line;
-    std::map<std::time_t, std::vector<string>> bars; // time_t is the date, the vector contains a string for each time in the day
+    BarStore bars;      // all bars, a day at a time
+    TextArena bar_text; // text of the bars, which is all that's left of each line once the next one is read
 
-    // read header; 
+    // read header;
     const string expected_header1{"\"Date\",\"Time\",\"Open\",\"High\",\"Low\",\"Close\",\"Up\",\"Down\"" };
     const string expected_header2{ "Date,Time,Open,High,Low,Close,Up,Down" };
 
     if (!std::getline(input_file, line)) {
-        cout << "***Error*** Inout file is empty" << endl;
+        log << "***Error*** Inout file is empty" << endl;
         return false;
     }
-    if (line != expected_header1 && line != expected_header2) 
-        cout << "***Warning*** First line is not expected header:" << expected_header2 << endl;
+    if (line != expected_header1 && line != expected_header2)
+        log << "***Warning*** First line is not expected header:" << expected_header2 << endl;
 
     // write header to output file
-    output_file << expected_header2 << ",OriginalDate" << endl;
-
-    // Read data, line by line and create dictionary<DateTime, Tick>
-    char* next_token = nullptr;
-    time_t cur_date_time_t = -1;
-    time_t initial_time_t = -1;
-    std::vector<string> bars_for_day;
-    int num_days = 0;
+    writeHeader(output_file, options.warmup_bars > 0);
+
+    // Read data, line by line and add each bar to the bar store
+    const auto parse_start = std::chrono::steady_clock::now();
+    LineHandler handler(options, stats, log);
+    StoredBars stored_bars(bars, bar_text, log);
     while (std::getline(input_file, line))
     {
-        // split line into fields
-        std::vector<string> fields = split(line, ",");
-        if (fields.size() != 8) {
-            cout << "***Error*** There must be 8 comma separated fields: " << line << endl;
+        stats.lines++;
+        if (!handler.handle(line, stored_bars))
             return false;
-        }
+    }
 
-        // convert date field to time_t;
-        if (!DateStringsToTime_t(line, fields[0], t))
-            return false;
-        if (initial_time_t == -1)
-            initial_time_t = t;
-
-        // if new day, save previous day in bars map and clear bars_for_day vector so it can be used for next day
-        if (t != cur_date_time_t) {
-            if (!bars_for_day.empty()) {
-                auto retval = bars.emplace(cur_date_time_t, std::move(bars_for_day));
-                num_days++;
-                bars_for_day.clear(); // resurrect moved bars_for_day
-
-                if (!retval.second) {
-                    cout << "***Error*** Duplicate date: " << line << endl;
-                    cur_date_time_t = t;
-                    continue;
-                }
-            }
-            cur_date_time_t = t;
-        }
+    if (!inputStreamOk(input_file, log))
+        return false;
 
-        //
-        // now add this bar to current bars_for_day vector
-        //
+    // save last day
+    handler.finish(line, stored_bars);
+    stats.parse_seconds = secondsSince(parse_start);
 
-        // add seconds to time field if it doesn't exist
-        if (fields[1].size() == 5)
-            fields[1] += ":00";
+    // ResampleBars closes output file; input file is closed by the caller
+    return ResampleBars(options, bars, handler.initialDay(), output_file, log, stats);
+}
 
-        // check open, high, low, close for minimum value
-        bool min_found = false;
-        for (int i = 2; i < 6; i++) {
-            if (atof(fields[i].c_str()) < min_value) {
-                bars_for_day.clear(); // throw away all prior bars for day;
-                min_found = true;
-                break;
-            }
+// returns next line of text (without end of line characters) and advances next past it; false at end of text,
+// just like std::getline
+bool nextLine(const char*& next, const char* end, std::string_view& line) {
+    if (next >= end)
+        return false;
+    const char* eol = (const char*)memchr(next, '\n', end - next);
+    if (eol == nullptr)
+        eol = end;
+    line = std::string_view(next, eol - next);
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+    next = eol + 1;
+    return true;
+}
+
+// the first line from line (the start of a line in [begin, end)) on whose date field isn't the same text as that of the
+// line before it, or end
+const char* nextDateChange(const char* begin, const char* line, const char* end) {
+    if (line <= begin || line >= end)
+        return line;
+    const char* previous = line - 1; // the previous line's '\n'
+    while (previous > begin && previous[-1] != '\n')
+        previous--;
+    const char* comma = (const char*)memchr(previous, ',', line - previous);
+    if (comma == nullptr)
+        return line;
+    const size_t date_size = comma - previous + 1; // with the comma
+    while ((size_t)(end - line) >= date_size && memcmp(line, previous, date_size) == 0) {
+        const char* eol = (const char*)memchr(line, '\n', end - line);
+        line = eol == nullptr ? end : eol + 1;
+    }
+    return line;
+}
+
+// same as ProcessCSVFile, but the input file is memory mapped and tokenized in place. Each bar is kept as a BarView
+// into the mapping instead of a newly built string, so the mapping must stay open until the output file is written.
+// If options.parse_threads > 1, large files are split into chunks which are parsed at the same time.
+// Produces exactly the same output file as ProcessCSVFile
+bool ProcessMappedCSVFile(const Options& options, const std::filesystem::path& input_path, OutputWriter& output_file, std::ostream& log, FileStats& stats) {
+    const auto open_start = std::chrono::steady_clock::now();
+    MappedFile input_file;
+    if (!input_file.open(input_path)) {
+        log << "***Error*** Unable to open '" << input_path << "' for reading." << endl;
+        return false;
+    }
+    stats.open_seconds += secondsSince(open_start);
+
+    BarStore bars;
+    std::vector<TextArena> owned_text;
+    DayNumber initial_day = 0;
+    if (!ParseCSVText(options, input_file.view(), bars, owned_text, initial_day, log, stats))
+        return false;
+
+    // write header to output file
+    writeHeader(output_file, options.warmup_bars > 0);
+
+    // input file is unmapped when input_file goes out of scope, after ResampleBars has written (and closed) output file
+    return ResampleBars(options, bars, initial_day, output_file, log, stats);
+}
+
+// parses text (a whole file, header first) into bars, which are views of text, or (for bars with empty fields) of
+// owned_text, which must be kept as long as bars. Used for memory mapped files and by ParsedBars (ResampleLibrary.h)
+bool ParseCSVText(const Options& options, std::string_view text, BarStore& bars, std::vector<TextArena>& owned_text, DayNumber& initial_day,
+    std::ostream& log, FileStats& stats) {
+    const auto parse_start = std::chrono::steady_clock::now();
+
+    const char* next = text.data();
+    const char* const end = next + text.size();
+    std::string_view line;
+
+    // read header;
+    const string expected_header1{ "\"Date\",\"Time\",\"Open\",\"High\",\"Low\",\"Close\",\"Up\",\"Down\"" };
+    const string expected_header2{ "Date,Time,Open,High,Low,Close,Up,Down" };
+
+    if (!nextLine(next, end, line)) {
+        log << "***Error*** Inout file is empty" << endl;
+        return false;
+    }
+    if (line != expected_header1 && line != expected_header2)
+        log << "***Warning*** First line is not expected header:" << expected_header2 << endl;
+
+    if (!ParseCSVLines(options, std::string_view(next, end - next), bars, owned_text, initial_day, log, stats))
+        return false;
+    stats.parse_seconds = secondsSince(parse_start);
+    return true;
+}
+
+// parses lines of bars (no header) into days added to bars after any it already has, which must all be finished. If
+// bars has none, initial_day is set to the first date. Bars are views of text or of owned_text, as for ParseCSVText
+bool ParseCSVLines(const Options& options, std::string_view text, BarStore& bars, std::vector<TextArena>& owned_text, DayNumber& initial_day,
+    std::ostream& log, FileStats& stats) {
+    const char* const next = text.data();
+    const char* const end = next + text.size();
+
+    // split text into chunks which each start at the beginning of a line. Small files are a single chunk;
+    // otherwise there are a few chunks per thread, so a thread which finishes early can take another thread's chunk
+    constexpr size_t min_chunk_size = 1024 * 1024;
+    const size_t data_size = end - next;
+    size_t num_chunks = 1;
+    if (options.parse_threads > 1)
+        num_chunks = std::clamp<size_t>(data_size / min_chunk_size, 1, 4 * (size_t)options.parse_threads);
+
+    std::vector<std::string_view> chunk_text;
+    const char* chunk_begin = next;
+    for (size_t i = 1; i <= num_chunks && chunk_begin < end; i++) {
+        const char* chunk_end = end;
+        if (i < num_chunks) {
+            chunk_end = std::max(chunk_begin, next + data_size * i / num_chunks);
+            const char* eol = (const char*)memchr(chunk_end, '\n', end - chunk_end);
+            chunk_end = eol == nullptr ? end : eol + 1;
+            // a coarser bar (--bar-size) mustn't be split between chunks, so they end where the date changes
+            if (options.bar_size.aggregating())
+                chunk_end = nextDateChange(chunk_begin, chunk_end, end);
         }
-        if (min_found)
-            continue;
+        chunk_text.emplace_back(chunk_begin, chunk_end - chunk_begin);
+        chunk_begin = chunk_end;
+    }
 
-        // create bar string without date field
-        std::ostringstream oss;
-        for (int i = 1; i < 8; i++)
-            oss << ',' << fields[i];
-        // append original date to end of string
-        oss << ',' << fields[0];
+    // parse and date convert chunks
+    std::vector<ParsedChunk> chunks(chunk_text.size());
+    if (chunks.size() == 1)
+        ParseChunk(options, chunk_text[0], chunks[0]);
+    else {
+        ThreadPool pool(options.parse_threads);
+        for (size_t i = 0; i < chunks.size(); i++)
+            pool.submit([&options, &chunk_text, &chunks, i] { ParseChunk(options, chunk_text[i], chunks[i]); });
+        pool.wait();
+    }
+
+    // Merge the chunks' days into the bar store, in file order. This does exactly what LineHandler does when the
+    // date changes from one line to the next, including its handling of duplicate dates. Each chunk's bars are freed
+    // once they have been copied, so there are never two copies of all bars
+    size_t total_bars = 0;
+    for (const ParsedChunk& chunk : chunks)
+        total_bars += chunk.bars.size();
+    bars.reserve(total_bars);
+    bool have_day = false;
+    const bool first_days = bars.empty();
+    for (ParsedChunk& chunk : chunks) {
+        for (DaySegment& segment : chunk.segments) {
+            if (!have_day && first_days)
+                initial_day = segment.date;
+            size_t first_bar = segment.first_bar;
+
+            // a day which continues from the previous chunk: a bar below minimum value throws away all prior bars
+            // of the day, including those from previous chunk
+            if (have_day && segment.date == bars.currentDate()) {
+                if (segment.cleared)
+                    bars.clearDay();
+            }
+            else {
+                // new day, finish previous day in bar store
+                stats.days_read++;
+                if (have_day && !bars.endDay()) {
+                    log << "***Error*** Duplicate date: " << segment.first_line << endl;
+                    stats.duplicate_dates++;
+                    // the line after a duplicate day is skipped
+                    if (segment.first_bar_kept)
+                        first_bar++;
+                }
+                bars.beginDay(segment.date);
+                have_day = true;
+            }
 
-        string xxx = oss.str();
-        // append bar string to bars_for_day vector
-        bars_for_day.emplace_back(oss.str());
+            for (size_t i = first_bar; i < segment.first_bar + segment.num_bars; i++)
+                bars.addBar(chunk.bars[i]);
+        }
+        chunk.bars = std::vector<BarView>();
+        owned_text.push_back(std::move(chunk.owned_text));
+        stats.add(chunk.stats);
+        log << chunk.warnings;
+
+        // parsing stopped at an invalid line
+        if (!chunk.error.empty()) {
+            log << chunk.error;
+            return false;
+        }
     }
 
     // save last day
-    if (!bars_for_day.empty()) {
-        auto retval = bars.emplace(cur_date_time_t, std::move(bars_for_day));
-        if (!retval.second)
-            cout << "***Error*** Duplicate date: " << line << endl;
+    if (have_day && !bars.endDay()) {
+        log << "***Error*** Duplicate date: " << chunks.back().last_line << endl;
+        stats.duplicate_dates++;
     }
+    return true;
+}
+
+// parses the lines of one chunk of a memory mapped file into runs of lines with the same date, applying the
+// minimum value filter within each run. Stops at the first invalid line, leaving its error message in chunk.error
+void ParseChunk(const Options& options, std::string_view text, ParsedChunk& chunk) {
+    const char* next = text.data();
+    const char* const end = next + text.size();
+    std::string_view line;
+    std::ostringstream errors, warnings;
+    LineHandler handler(options, chunk.stats, errors, warnings);
+    ChunkBars bars(chunk, errors);
+    while (nextLine(next, end, line))
+    {
+        chunk.last_line = line;
+        chunk.stats.lines++;
+        if (!handler.handle(line, bars))
+            break;
+    }
+    // the chunk's last day may go on in the next chunk, so it's ended when they're merged
+    handler.finishBar(bars);
+    // and days are counted then, so one that's split between chunks is only counted once
+    chunk.stats.days_read = 0;
+
+    chunk.error = errors.str();
+    chunk.warnings = warnings.str();
+}
+
+// splits the days in bars into training, validation and test sets in the requested ratio, then writes them to output_file
+// and closes it
+bool ResampleBars(const Options& options, BarStore& bars, DayNumber initial_day, OutputWriter& output_file, std::ostream& log, FileStats& stats) {
+    const auto partition_start = std::chrono::steady_clock::now();
+    bars.sortDays();
+    stats.days_kept = bars.days().size();
+    stats.bars_kept = bars.barCount();
 
     // check for no valid days
     if (bars.empty()) {
-        cout << "***Error*** After filtering for minimum value, input file is empty" << endl;
+        log << "***Error*** After filtering for minimum value, input file is empty" << endl;
         return false;
     }
 
@@ -333,173 +1221,145 @@ bool ProcessCSVFile(char interval, std::vector<int> ratio, float min_value, std:
     // here's where the magic occurs. We split up the data into train, validate and test sets in the requested ratio
     //
 
-    // now place entries from main map into one of three vectors (training, validation, test)
-    // each vector contains a vector of ticks for a whole day
-    std::vector<std::vector<string>> training_set;
-    std::vector<std::vector<string>> validation_set;
-    std::vector<std::vector<string>> test_set;
-    std::vector<std::vector<string>>* pSelectedSet{ nullptr };
-
-    auto day_iterator = bars.begin();
-    time_t start_day = (*day_iterator).first;
-    int start_period_number;
-    int cur_period{ 0 };
-
-    while (true) {
-        for (int i = 0; i < 3; i++) {
-            switch (i) {
-            case 0: pSelectedSet = &training_set; break;
-            case 1: pSelectedSet = &validation_set; break;
-            case 2: pSelectedSet = &test_set; break;
-            }
-
-            // yes...I could have "compressed" this with lambda's...but this is easier to understand and debug
-            switch (interval) {
-            case 'd': // ratio vector is in days: ratio[0]=# training days, ratio[1]=# of validation days, ratio[2]=# of test days
-                while (true) {
-                    for (int i = 0; i < 3; i++) {
-                        switch (i) {
-                        case 0: pSelectedSet = &training_set; break;
-                        case 1: pSelectedSet = &validation_set; break;
-                        case 2: pSelectedSet = &test_set; break;
-                        }
+    // Rather than moving the days themselves, list the index of each day in bars in the set it goes to. The periods of
+    // interval (days, weeks, months, ...) are dealt out ratio[0] to training, ratio[1] to validation, ratio[2] to test,
+    // and around again
+    // With --universe, the periods were dealt out once for all files, and the days are looked up in that table.
+    // The output file is just one user of the partitions (see ResampleLibrary.h)
+    Partitions partitions;
+    if (!partitionDays(options, bars.days(), initial_day, partitions, log))
+        return false;
+    stats.partition_seconds += secondsSince(partition_start);
 
-                        // place ratio[i] # of days into selected vector
-                        for (int j = 0; j < ratio[i]; j++) {
-                            if (day_iterator == bars.end())
-                                goto end;
-                            std::vector<string>& day = (*day_iterator++).second;
-                            pSelectedSet->emplace_back(std::move(day)); // we will never ever try and use this entry in bars map
-                        }
-                    }
-                }
-                break;
+    // write output file
+    const auto write_start = std::chrono::steady_clock::now();
+    const SharedCalendar* calendar = options.universe != nullptr ? &options.universe->calendar : nullptr;
+    DayNumber next_day = writeOutputFile(output_file, bars, partitions.dayIndexes(DatasetAssigner::training), initial_day, "training", log, options.warmup_bars, calendar);
+    next_day = writeOutputFile(output_file, bars, partitions.dayIndexes(DatasetAssigner::validation), next_day, "validation", log, options.warmup_bars, calendar);
+    writeOutputFile(output_file, bars, partitions.dayIndexes(DatasetAssigner::test), next_day, "test", log, options.warmup_bars, calendar);
+    if (!output_file.close()) {
+        log << "***Error*** Unable to write output file. The disk might be full." << endl;
+        return false;
+    }
 
-            case 'w': // ratio vector is in weeks: ratio[0]=# training weeks, ratio[1]=# of validation weeks, ratio[2]=# of test weeks
-                start_period_number = weekNumber(start_day);
-                while (true) {
-                    for (int i = 0; i < 3; i++) {
-                        switch (i) {
-                        case 0: pSelectedSet = &training_set; break;
-                        case 1: pSelectedSet = &validation_set; break;
-                        case 2: pSelectedSet = &test_set; break;
-                        }
+    stats.write_seconds += secondsSince(write_start);
+    logWriteSpeed(output_file, std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count(), log);
 
-                        // place ratio[i] # of weeks into selected vector
-                        for (int j = 0; j < ratio[i]; j++, cur_period++) {
-                            // put a whole weeks worth of days into selected vector
-                            while ((day_iterator != bars.end()) && weekNumber(start_period_number, (*day_iterator).first) == cur_period) {
-                                std::vector<string>& day = (*day_iterator++).second;
-                                // because of std::move, we can never use this entry in bars map after this point in the code
-                                pSelectedSet->emplace_back(std::move(day));
-                            }
-                            if (day_iterator == bars.end())
-                                goto end;
-                        }
-                    }
-                }
-                break;
+    // same bars, split other ways
+    if (!options.splits.empty())
+        return WriteSplits(options, bars, initial_day, output_file.path(), log, stats);
+    return true;
+}
 
-            case 'm': // ratio vector is in months: ratio[0]=# training months, ratio[1]=# of validation months, ratio[2]=# of test months
-                start_period_number = monthNumber(start_day);
-                while (true) {
-                    for (int i = 0; i < 3; i++) {
-                        switch (i) {
-                        case 0: pSelectedSet = &training_set; break;
-                        case 1: pSelectedSet = &validation_set; break;
-                        case 2: pSelectedSet = &test_set; break;
-                        }
+// lists the index of each day in days in the data set it goes to. Days must be in date order (see BarStore::sortDays)
+void assignDatasets(std::span<const BarStore::Day> days, const Interval& interval, const std::vector<int>& ratio, int offset, std::vector<uint32_t>(&dataset_days)[3]) {
+    if (days.empty())
+        return;
+    DatasetAssigner assigner(interval, ratio, offset);
+    const CalendarIndex calendar(interval, days.front().date, days.back().date);
+    for (uint32_t i = 0; i < (uint32_t)days.size(); i++)
+        dataset_days[assigner.assignPeriod(calendar.period(days[i].date))].push_back(i);
+}
 
-                        // place ratio[i] # of months into selected vector
-                        for (int j = 0; j < ratio[i]; j++, cur_period++) {
-                            // put a whole weeks worth of days into selected vector
-                            while ((day_iterator != bars.end()) && monthNumber(start_period_number, (*day_iterator).first) == cur_period) {
-                                std::vector<string>& day = (*day_iterator++).second;
-                                // because of std::move, we can never use this entry in bars map after this point in the code
-                                pSelectedSet->emplace_back(std::move(day));
-                            }
-                            if (day_iterator == bars.end())
-                                goto end;
-                        }
-                    }
-                }
-                break;
+void logWriteSpeed(const OutputWriter& output_file, double seconds, std::ostream& log) {
+    const double mb = output_file.bytesWritten() / (1024.0 * 1024.0);
+    char rate[100];
+    snprintf(rate, sizeof(rate), "Wrote %.1f MB in %.3f seconds (%.1f MB/s)", mb, seconds, seconds > 0 ? mb / seconds : 0.0);
+    log << rate << endl;
+}
+
+// writes the given days (indexes in bars) to output file, dated from day on. Returns the day after the last one
+// With warmup_bars, each run of days that doesn't carry straight on from the day before it in bars is preceded by the
+// warmup_bars bars before it, flagged 1 in the Warmup column (the run's own bars are flagged 0). The warm-up days get
+// dates of their own, so dates still go up a day at a time.
+// With a shared calendar (--universe), each day's new date comes from the calendar instead, so it's the same in every file
+DayNumber writeOutputFile(OutputWriter& output_file, const BarStore& bars, const std::vector<uint32_t>& days, DayNumber day, const string& dataset_name, std::ostream& log,
+    unsigned warmup_bars, const SharedCalendar* calendar) {
+    char buffer[formatted_date_size + 1]{};
+    DayNumber initial_day = day;
+    const std::string_view flag = warmup_bars > 0 ? ",0" : "";
+
+    for (size_t i = 0; i < days.size(); i++) {
+        const uint32_t day_index = days[i];
+        if (warmup_bars > 0 && (i == 0 || days[i - 1] + 1 != day_index)) {
+            // the bars are written from where they are in bars, like any other
+            const WarmupRange range = warmupRange(bars, day_index, warmup_bars);
+            for (uint32_t warmup_day = range.first_day; warmup_day < day_index; warmup_day++) {
+                formatDate(day++, buffer);
+                const std::string_view date(buffer, formatted_date_size);
+                const std::span<const BarView> day_bars = bars.bars(bars.days()[warmup_day]);
+                for (const BarView& bar : day_bars.subspan(warmup_day == range.first_day ? range.skip : 0))
+                    writeBar(output_file, date, bar, ",1");
             }
         }
+
+        const BarStore::Day& store_day = bars.days()[day_index];
+        assert(store_day.num_bars > 0);
+        if (calendar != nullptr) {
+            day = calendar->newDate(store_day.date);
+            if (i == 0)
+                initial_day = day;
+        }
+        formatDate(day, buffer); // mm/dd/yyyy, once per day
+        const std::string_view date(buffer, formatted_date_size);
+        for (const BarView& bar : bars.bars(store_day))
+            writeBar(output_file, date, bar, flag);
+        day++;
     }
-end:
 
-    // write output file
-    time_t next_day_time_t = writeOutputFile(output_file, training_set, initial_time_t, "training");
-    next_day_time_t = writeOutputFile(output_file, validation_set, next_day_time_t, "validation");
-    writeOutputFile(output_file, test_set, next_day_time_t, "test");
+    char init_buffer[formatted_date_size + 1]{};
+    formatDate(initial_day, init_buffer);
+    formatDate(day - 1, buffer);
+    log << "Writing " << dataset_name << " dataset from " << init_buffer << "  to " << buffer << endl;
+    return day;
+}
 
-    // Close files
-    input_file.close();
-    output_file.close();
-    return true;
+WarmupRange warmupRange(const BarStore& bars, uint32_t day_index, unsigned warmup_bars) {
+    WarmupRange range{ day_index, 0 };
+    size_t num_bars = 0;
+    while (range.first_day > 0 && num_bars < warmup_bars)
+        num_bars += bars.days()[--range.first_day].num_bars;
+    if (num_bars > warmup_bars)
+        range.skip = (uint32_t)(num_bars - warmup_bars);
+    return range;
 }
 
-time_t writeOutputFile(std::ofstream& output_file, const std::vector<std::vector<string>>& days, time_t day_time_t, const string& dataset_name) {
-    struct tm timeinfo;
-    char init_time_buffer[32];
-    char buffer[32];
-    time_t initial_day_time_t = day_time_t;
-    localtime_s(&timeinfo, &day_time_t);  // convert time_t in kvp.first to tm in timeinfo
-    std::strftime(init_time_buffer, 32, "%m/%d/%Y", &timeinfo); // mm/dd/yyyy
-
-    for (std::vector<string> day : days) {
-        assert(!day.empty());
-        for (string& bar : day) {
-            localtime_s(&timeinfo, &day_time_t);  // convert time_t in kvp.first to tm in timeinfo
-            std::strftime(buffer, 32, "%m/%d/%Y", &timeinfo); // mm/dd/yyyy
-            output_file << buffer << bar << endl;
-        }
-        day_time_t += seconds_in_day;
-    }
-
-    time_t last_time_t = day_time_t - seconds_in_day;
-    localtime_s(&timeinfo, &last_time_t);  // convert time_t in kvp.first to tm in timeinfo
-    std::strftime(buffer, 32, "%m/%d/%Y", &timeinfo); // mm/dd/yyyy,
-    cout << "Writing " << dataset_name << " dataset from " << init_time_buffer << "  to " << buffer << endl;
-    return day_time_t;
+void writeHeader(OutputWriter& output_file, bool warmup_column) {
+    output_file.write("Date,Time,Open,High,Low,Close,Up,Down,OriginalDate");
+    if (warmup_column)
+        output_file.write(",Warmup");
+    output_file.write(line_end);
 }
 
-// returns time_t corresponding to given date string
-bool DateStringsToTime_t(const string& line, const string& date, std::time_t& t) {
-    std::tm datetime_tm;
-    std::istringstream ss(date + " 00:00:00");
-    ss >> std::get_time(&datetime_tm, "%m/%d/%Y %H:%M:%S");
-    if (ss.fail()) {
-        cout << "***Error*** Invalid date: " << line << endl;
-        return false;
+// writes one output line: remapped date,time,open,high,low,close,up,down,original date, then suffix (if any)
+void writeBar(OutputWriter& output_file, std::string_view date, const BarView& bar, std::string_view suffix) {
+    output_file.write(date);
+    output_file.write(',');
+    // time, open, ..., down are one slice of the input line, unless seconds have to be added to time
+    if (bar.time().size() != 5)
+        output_file.writeReference(bar.timeAndValues());
+    else {
+        output_file.write(bar.time());
+        output_file.write(":00"); // add seconds to time field
+        output_file.write(',');
+        output_file.writeReference(bar.values());
     }
+    output_file.write(',');
+    output_file.write(bar.date());
+    if (!suffix.empty())
+        output_file.write(suffix);
+    output_file.write(line_end);
+}
 
-    t = std::mktime(&datetime_tm);
-    if (t == -1) {
-        cout << "***Error*** Invalid date: " << line << endl;
+// converts given mm/dd/yyyy date string to a day number
+bool DateStringToDayNumber(std::string_view line, std::string_view date, DateParser& date_parser, DayNumber& day, std::ostream& log) {
+    if (!date_parser.parse(date, day)) {
+        log << "***Error*** Invalid date: " << line << endl;
         return false;
     }
-
     return true;
 }
 
-// poor man's string split function
-std::vector<string> split(const string& line, const char* delimiter) {
-    std::vector<string> fields;
-
-    char* next_token = nullptr;
-    const char* ctoken = strtok_s((char*)line.c_str(), delimiter, &next_token);
-    while (ctoken != nullptr) {
-        // save token
-        string token{ ctoken };
-        fields.emplace_back(string(ctoken));
-        ctoken = strtok_s(0, delimiter, &next_token);
-    }
-
-    return fields;
-}
-
 // uses Zeller's algorithm to find day of week; 0 = Saturday
 int dayOfWeek(int day, int month, int year) {
     int mon;
@@ -517,38 +1377,51 @@ int dayOfWeek(int day, int month, int year) {
 
 // returns week number relative to week number of starting date
 // week begins on Sunday, ends on Saturday
-int weekNumber(int start_week_number, time_t curDate) {
+int weekNumber(int start_week_number, DayNumber curDate) {
     return weekNumber(curDate) - start_week_number;
 }
 
-// returns week number relative to Jan 1, 1970 - where time_t is 0
-int weekNumber(time_t t) {
-    // get day of week of startDate
-    std::tm date_tm;
-    localtime_s(&date_tm, &t);
-    const int start_day_of_week = date_tm.tm_wday;
+// returns week number relative to the week of Jan 1, 1970
+int weekNumber(DayNumber day) {
     // compute # of days since Dec 28, 1969, a Sunday
-    // then, week number is just the day number divided by 7
-    const long day_num = (long)t / seconds_in_day + 4;
-    return day_num / 7;
+    // then, week number is just the day number divided by 7 (rounded down, for dates before 1970)
+    const int days_since_sunday = day + 4;
+    return days_since_sunday >= 0 ? days_since_sunday / 7 : (days_since_sunday - 6) / 7;
 }
 
-int monthNumber(int start_month_number, time_t curDate) {
+int monthNumber(int start_month_number, DayNumber curDate) {
     return monthNumber(curDate) - start_month_number;
 }
 
-// get # of months between given time_t and Jan 1970
-int monthNumber(time_t t) {
-    std::tm date_tm;
-    localtime_s(&date_tm, &t);
-    const int years_since_1970 = date_tm.tm_year - 70;
-    return years_since_1970 * 12 + date_tm.tm_mon;
+// get # of months between given day and Jan 1970
+int monthNumber(DayNumber day) {
+    const CivilDate date = civilFromDays(day);
+    return (date.year - 1970) * 12 + (int)date.month - 1;
+}
+
+DatasetAssigner::DatasetAssigner(const Interval& interval, const std::vector<int>& ratio, int offset) : interval_(interval), offset_(offset) {
+    for (int i = 0; i < 3; i++)
+        ratio_[i] = ratio[i];
+    cycle_length_ = ratio_[0] + ratio_[1] + ratio_[2];
+}
+
+DatasetAssigner::Dataset DatasetAssigner::assignPeriod(int calendar_period) {
+    if (!started_) {
+        start_period_ = calendar_period;
+        started_ = true;
+    }
+    // position of this day's period in the training/validation/test cycle; days periods are counted in days with bars
+    const int period = interval_.kind == Interval::days ? day_count_++ / interval_.length : calendar_period - start_period_;
+    const int position = (period + offset_) % cycle_length_;
+    if (position < ratio_[0])
+        return training;
+    if (position < ratio_[0] + ratio_[1])
+        return validation;
+    return test;
 }
 
-bool checkPeriod(std::function<int(int, const time_t)> periodNumberFunc, int start_period_number, const time_t cur_time, int cur_period) {
-    int xx = periodNumberFunc(start_period_number, cur_time);
-    bool bb = xx == cur_period;
-    return periodNumberFunc(start_period_number, cur_time) == cur_period;
+bool checkPeriod(std::function<int(int, const DayNumber)> periodNumberFunc, int start_period_number, const DayNumber cur_day, int cur_period) {
+    return periodNumberFunc(start_period_number, cur_day) == cur_period;
 }
 
 #if 0 // for debugging only to make sure weeks are interleaved properly...must remove for production
@@ -0,0 +1,290 @@
+//
+// ResampleStockData.h : declarations shared by the source files of ResampleStockData
+//
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "BarAggregator.h"
+#include "BarStore.h"
+#include "Calendar.h"
+#include "CivilDate.h"
+#include "Compression.h"
+#include "FieldScanner.h"
+#include "OutputWriter.h"
+#include "Stats.h"
+
+// how input files are read
+enum class IOMode {
+    stream, // std::getline + split(); one heap string per field and per bar
+    mmap    // memory map the file and tokenize it in place; bars are views into the mapping
+};
+
+// one more way to split the data sets, written to its own output file (--splits)
+struct SplitConfig {
+    Interval interval;
+    std::vector<int> ratio;
+    int offset{ 0 }; // # of periods the ratio cycle is rotated by, e.g. ratio[0] + ratio[1] puts a test period first
+
+    // used in output file names, e.g. w_3-2-1, w_3-2-1_o5 or 5d_3-2-1
+    std::string name() const {
+        std::string text = interval.text() + "_" + std::to_string(ratio[0]) + "-" + std::to_string(ratio[1]) + "-" + std::to_string(ratio[2]);
+        if (offset != 0)
+            text += "_o" + std::to_string(offset);
+        return text;
+    }
+};
+
+class SharedCalendar;
+struct Universe;
+
+// command line options
+struct Options {
+    std::filesystem::path directory;
+    Interval interval;
+    std::vector<int> ratio;
+    float min_value{ 1.0f };
+    BarSize bar_size;            // bars written: the input bars, or coarser ones made from them as they're parsed (--bar-size)
+    bool check_bars{ false };    // skip bars whose high and low aren't the highest and lowest prices, or with negative up or down
+    IOMode io_mode{ IOMode::mmap };
+    unsigned num_threads{ 1 };  // # of files resampled at the same time
+    unsigned max_memory_mb{ 0 }; // limit on estimated memory held by files being resampled at the same time; 0 = no limit
+    unsigned parse_threads{ 1 }; // # of threads parsing one (large) file; mmap only
+    bool gather_writes{ false }; // write bar text straight from where it is with writev instead of copying it to output buffer
+    Compression output_compression{ Compression::none }; // of output files (not of spill, run or index files)
+    bool replace_outputs{ false }; // write each output file as .tmp and rename it over the old one when it's complete (--watch)
+    bool streaming{ false };     // write each day as soon as it is complete instead of reading whole file first
+    bool pipeline{ false };      // read, parse and write on separate threads, each day written as soon as it is complete
+    bool cache{ false };         // keep parsed bars of each input file in a .rsbin file, and use it instead of parsing when it's up to date
+    bool incremental{ false };   // update output files from the bars appended to input files since the last run
+    bool verify{ false };        // check incremental output against a full run
+    std::vector<SplitConfig> splits; // more interval/ratio/offset combinations, each written from the same parsed bars
+    bool split_index{ false };   // write each split as an index into one file of all bars instead of a full copy
+    std::filesystem::path stats_path; // write timers and counters of each file here, as JSON; empty = don't
+    bool sort{ false };          // input lines in any order, and name.partN.csv files as parts of name.csv; sorted within sort_memory_mb
+    unsigned sort_memory_mb{ 256 };
+    unsigned warmup_bars{ 0 };   // # of bars written (flagged) before each run of days that doesn't follow on from the day before it
+    bool shared_calendar{ false }; // split every file by one calendar of the dates of all of them (--universe)
+    std::shared_ptr<const Universe> universe; // that calendar, made by main before any file is resampled
+    bool watch{ false };         // keep running, resampling each file again whenever it changes
+    unsigned watch_memory_mb{ 1024 }; // limit on the text and bars kept in memory between changes; 0 = no limit
+    unsigned watch_debounce_ms{ 200 }; // a file is resampled once it has had no changes for this long
+};
+
+constexpr size_t output_buffer_size = 4 * 1024 * 1024;
+
+// Decides which data set each day goes to: the periods of interval (blocks of days with bars, weeks, months, ...) are
+// dealt out ratio[0] to training, ratio[1] to validation, ratio[2] to test, and around again, counting from the period
+// of the first day (moved on by offset periods). A calendar period with no days still uses up its place
+class DatasetAssigner {
+public:
+    enum Dataset { training = 0, validation = 1, test = 2 };
+
+    DatasetAssigner(const Interval& interval, const std::vector<int>& ratio, int offset = 0);
+    // days must be passed in increasing date order
+    Dataset assign(DayNumber day) { return assignPeriod(interval_.kind == Interval::days ? 0 : periodNumber(interval_, day)); }
+    // same, given the day's periodNumber (from a CalendarIndex)
+    Dataset assignPeriod(int calendar_period);
+
+    // where the assigner is in the cycle, so a later run can carry on from there
+    struct State {
+        bool started;
+        int start_period;
+        int day_count;
+    };
+    State state() const { return State{ started_, start_period_, day_count_ }; }
+    void restore(const State& state) {
+        started_ = state.started;
+        start_period_ = state.start_period;
+        day_count_ = state.day_count;
+    }
+
+private:
+    Interval interval_;
+    int ratio_[3];
+    int cycle_length_;
+    int offset_;
+    bool started_{ false };
+    int start_period_{ 0 };
+    int day_count_{ 0 };
+};
+
+// shared by the ways of processing a file
+bool nextLine(const char*& next, const char* end, std::string_view& line);
+bool DateStringToDayNumber(std::string_view line, std::string_view date, DateParser& date_parser, DayNumber& day, std::ostream& log);
+int weekNumber(DayNumber day);
+int weekNumber(int start_week_number, DayNumber curDate);
+int monthNumber(DayNumber day);
+int monthNumber(int start_month_number, DayNumber curDate);
+void writeHeader(OutputWriter& output_file, bool warmup_column = false);
+void logWriteSpeed(const OutputWriter& output_file, double seconds, std::ostream& log);
+void writeBar(OutputWriter& output_file, std::string_view date, const BarView& bar, std::string_view suffix = {});
+bool ProcessMappedCSVFile(const Options& options, const std::filesystem::path& input_path, OutputWriter& output_file, std::ostream& log, FileStats& stats);
+bool ParseCSVText(const Options& options, std::string_view text, BarStore& bars, std::vector<TextArena>& owned_text, DayNumber& initial_day,
+    std::ostream& log, FileStats& stats);
+bool ParseCSVLines(const Options& options, std::string_view text, BarStore& bars, std::vector<TextArena>& owned_text, DayNumber& initial_day,
+    std::ostream& log, FileStats& stats);
+bool ResampleBars(const Options& options, BarStore& bars, DayNumber initial_day, OutputWriter& output_file, std::ostream& log, FileStats& stats);
+void assignDatasets(std::span<const BarStore::Day> days, const Interval& interval, const std::vector<int>& ratio, int offset, std::vector<uint32_t>(&dataset_days)[3]);
+DayNumber writeOutputFile(OutputWriter& output_file, const BarStore& bars, const std::vector<uint32_t>& days, DayNumber initial_day, const std::string& dataset_name, std::ostream& log,
+    unsigned warmup_bars = 0, const SharedCalendar* calendar = nullptr);
+// the warmup_bars bars before day day_index in bars: from bar skip of day first_day to the end of day day_index - 1
+struct WarmupRange {
+    uint32_t first_day;
+    uint32_t skip;
+};
+WarmupRange warmupRange(const BarStore& bars, uint32_t day_index, unsigned warmup_bars);
+
+// StreamingResampler.cpp
+bool ProcessCSVFileStreaming(const Options& options, const std::filesystem::path& input_path, OutputWriter& output_file,
+    const std::filesystem::path& output_path, std::ostream& log, FileStats& stats);
+
+// a day's bars, as they will appear in the output file except for the new date at the start of each line
+class DayBuffer {
+public:
+    void addBar(std::string_view date, std::string_view time, const std::string_view* values) {
+        line_starts_.push_back(text_.size());
+        text_.append(formatted_date_size, ' '); // new date goes here
+        (text_ += ',') += time;
+        // add seconds to time field if it doesn't exist
+        if (time.size() == 5)
+            text_ += ":00";
+        for (int i = 0; i < 6; i++)
+            (text_ += ',') += values[i];
+        // append original date to end of line
+        (text_ += ',') += date;
+        text_ += line_end;
+    }
+
+    void setDate(DayNumber day);
+
+    void clear() {
+        text_.clear();
+        line_starts_.clear();
+    }
+
+    bool empty() const { return line_starts_.empty(); }
+    size_t numBars() const { return line_starts_.size(); }
+    std::string_view text() const { return text_; }
+
+private:
+    std::string text_;
+    std::vector<size_t> line_starts_;
+};
+
+// where a complete day's date falls, given the dates of the days saved before it (in increasing order). A next day is
+// added to saved_days
+enum class DayOrder { next, duplicate, out_of_order };
+DayOrder checkDayOrder(std::vector<DayNumber>& saved_days, DayNumber day);
+
+// Sends complete days, in increasing date order, to their data sets. Training days go straight to the output file.
+// Validation and test days can't, because their new dates depend on how many training days there are, so they go to
+// spill files next to the output file, which finish copies in after the last training day
+class DatasetWriter {
+public:
+    DatasetWriter(const Options& options, OutputWriter& output_file, FileStats& stats)
+        : output_file_(output_file), assigner_(options.interval, options.ratio), stats_(stats) {}
+    ~DatasetWriter() { removeSpillFiles(); }
+    DatasetWriter(const DatasetWriter&) = delete;
+    DatasetWriter& operator=(const DatasetWriter&) = delete;
+
+    // creates the spill files
+    bool open(const std::filesystem::path& output_path, std::ostream& log);
+    // training days are dated from initial_day on. Must be called before the first write
+    void start(DayNumber initial_day) { initial_day_ = initial_day; next_training_day_ = initial_day; }
+    // writes day_bars as day's bars and clears it
+    void write(DayNumber day, DayBuffer& day_bars);
+    // copies the spilled days to the output file after the training days and closes it
+    bool finish(std::ostream& log);
+
+private:
+    struct SpillFile {
+        std::filesystem::path path;
+        OutputWriter writer{ 256 * 1024 };
+        std::vector<size_t> bars_per_day;
+    };
+
+    DayNumber copySpillFile(SpillFile& spill, DayNumber day, const std::string& dataset_name, std::ostream& log, bool& ok);
+    void removeSpillFiles();
+
+    OutputWriter& output_file_;
+    DatasetAssigner assigner_;
+    FileStats& stats_; // partition and write times, days and bars kept
+    SpillFile spills_[2]; // validation, test
+    DayNumber initial_day_{ 0 };
+    DayNumber next_training_day_{ 0 };
+    size_t day_count_{ 0 };
+    std::chrono::steady_clock::time_point write_start_;
+};
+
+// PipelinedResampler.cpp
+bool ProcessCSVFilePipelined(const Options& options, const std::filesystem::path& input_path, OutputWriter& output_file,
+    const std::filesystem::path& output_path, std::ostream& log, FileStats& stats);
+
+// ExternalSort.cpp
+// name of the file without .csv (or .csv.gz or .csv.zst) or, for a part file name.partN.csv, without .partN.csv
+std::string inputStem(const std::filesystem::path& path);
+// every .csv (or compressed .csv) file in path's directory with path's inputStem (name.csv first, then the parts in part number order)
+std::vector<std::filesystem::path> findParts(const std::filesystem::path& path);
+bool ProcessCSVFilesSorted(const Options& options, const std::vector<std::filesystem::path>& input_paths, OutputWriter& output_file,
+    const std::filesystem::path& output_path, std::ostream& log, FileStats& stats);
+
+// BarCache.cpp
+uint64_t hashBytes(const char* data, size_t size);
+int64_t modificationTime(const std::filesystem::path& path);
+bool ProcessCachedCSVFile(const Options& options, const std::filesystem::path& input_path, const std::filesystem::path& cache_path,
+    OutputWriter& output_file, std::ostream& log, FileStats& stats);
+
+// IncrementalResampler.cpp
+bool ProcessCSVFileIncremental(const Options& options, const std::filesystem::path& input_path, const std::filesystem::path& output_path, std::ostream& log,
+    FileStats& stats);
+
+// SplitOutputs.cpp
+bool WriteSplits(const Options& options, const BarStore& bars, DayNumber initial_day, const std::filesystem::path& output_path, std::ostream& log,
+    FileStats& stats);
+
+// Universe.cpp
+// The data set and new date of every date of the universe (the input files), dealt out as assignDatasets would for
+// one file with all of those dates
+class SharedCalendar {
+public:
+    // days: every date of every file, in increasing order, each once
+    SharedCalendar(const std::vector<DayNumber>& days, const Interval& interval, const std::vector<int>& ratio, int offset);
+    // false if day isn't one of the dates the calendar was made from
+    bool find(DayNumber day, DatasetAssigner::Dataset& dataset) const;
+    // day must be one of the dates the calendar was made from
+    DayNumber newDate(DayNumber day) const { return entries_[day - first_].new_date; }
+    size_t dayCount(DatasetAssigner::Dataset dataset) const { return day_counts_[dataset]; }
+
+private:
+    struct Entry {
+        int8_t dataset{ -1 }; // -1: no file has the day
+        DayNumber new_date{ 0 };
+    };
+    DayNumber first_{ 0 };
+    std::vector<Entry> entries_; // a day at a time from the first date to the last
+    size_t day_counts_[3]{};
+};
+
+struct Universe {
+    SharedCalendar calendar;            // -i and -r
+    std::vector<SharedCalendar> splits; // one per --splits, in the same order
+};
+
+// reads the dates of all the files; null if there are none
+std::shared_ptr<const Universe> BuildUniverse(const Options& options, const std::vector<std::filesystem::path>& paths, std::ostream& log);
+// assignDatasets, by a shared calendar. Returns false if a day of bars isn't in it
+bool assignDatasets(std::span<const BarStore::Day> days, const SharedCalendar& calendar, std::vector<uint32_t>(&dataset_days)[3], std::ostream& log);
+
+// Watcher.cpp
+// resamples the files, then each file of the directory again whenever it changes, until stopped (Ctrl+C). Returns
+// false if the directory can't be watched
+bool WatchDirectory(const Options& options, const std::vector<std::filesystem::path>& paths);
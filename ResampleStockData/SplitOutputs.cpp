@@ -0,0 +1,164 @@
+//
+// SplitOutputs.cpp : writes the bars of a file split in more ways (--splits), without parsing the file again
+//
+// Each split is written either as a full output file, <name>_resampled_<split>.csv, or (with --split-files=index) as
+// a small index, <name>_resampled_<split>.idx, into <name>_resampled_bars.csv, which has every bar once in date order.
+// An index has a line per day, in output file order: data set, new date, first bar (counting from 0, not counting the
+// header line) and number of bars of that day in the bars file. With --warmup, a day's warm-up bars are a line of
+// their own, with warmup as the data set
+//
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ResampleStockData.h"
+
+using std::endl;
+using std::string;
+
+namespace {
+
+const char* const dataset_names[3] = { "training", "validation", "test" };
+
+// output file name with suffix added to its stem, e.g. a_resampled.csv -> a_resampled_w_3-2-1.idx (or, with
+// --compress-output, a_resampled.csv.gz -> a_resampled_w_3-2-1.csv.gz)
+std::filesystem::path splitPath(const std::filesystem::path& output_path, const string& suffix, const char* extension, Compression compression) {
+    std::filesystem::path path = output_path;
+    path.replace_filename(csvStem(output_path) + "_" + suffix + extension + compressionExtension(compression));
+    return path;
+}
+
+// writes every bar once, in date order, with its original date in the Date column too. Returns index of each day's
+// first bar in the file
+bool writeBarsFile(const BarStore& bars, const std::filesystem::path& path, Compression compression, bool replace, std::vector<uint64_t>& first_bars,
+    std::ostream& log, FileStats& stats) {
+    OutputWriter bars_file(output_buffer_size);
+    if (!bars_file.open(path, compression, replace)) {
+        log << "***Error*** Unable to create '" << path.string() << "' for writing." << endl;
+        return false;
+    }
+    writeHeader(bars_file);
+    uint64_t bar_count = 0;
+    for (const BarStore::Day& day : bars.days()) {
+        first_bars.push_back(bar_count);
+        for (const BarView& bar : bars.bars(day))
+            writeBar(bars_file, bar.date(), bar);
+        bar_count += day.num_bars;
+    }
+    if (!bars_file.close()) {
+        log << "***Error*** Unable to write '" << path.string() << "'. The disk might be full." << endl;
+        return false;
+    }
+    stats.bytes_written += bars_file.bytesWritten();
+    log << "Wrote all bars to '" << path.filename().string() << "'" << endl;
+    return true;
+}
+
+void writeIndexLine(OutputWriter& index_file, const char* dataset_name, DayNumber day, uint64_t first_bar, uint64_t num_bars) {
+    char buffer[formatted_date_size + 1]{};
+    formatDate(day, buffer);
+    index_file.write(dataset_name);
+    index_file.write(',');
+    index_file.write(std::string_view(buffer, formatted_date_size));
+    index_file.write(',');
+    index_file.write(std::to_string(first_bar));
+    index_file.write(',');
+    index_file.write(std::to_string(num_bars));
+    index_file.write(line_end);
+}
+
+// index version of writeOutputFile. Returns the day after the last one
+DayNumber writeIndexFile(OutputWriter& index_file, const BarStore& bars, const std::vector<uint64_t>& first_bars, const std::vector<uint32_t>& days,
+    DayNumber day, const char* dataset_name, unsigned warmup_bars, const SharedCalendar* calendar, std::ostream& log) {
+    char buffer[formatted_date_size + 1]{};
+    DayNumber initial_day = day;
+    for (size_t i = 0; i < days.size(); i++) {
+        const uint32_t day_index = days[i];
+        if (warmup_bars > 0 && (i == 0 || days[i - 1] + 1 != day_index)) {
+            const WarmupRange range = warmupRange(bars, day_index, warmup_bars);
+            for (uint32_t warmup_day = range.first_day; warmup_day < day_index; warmup_day++) {
+                const uint32_t skip = warmup_day == range.first_day ? range.skip : 0;
+                writeIndexLine(index_file, "warmup", day++, first_bars[warmup_day] + skip, bars.days()[warmup_day].num_bars - skip);
+            }
+        }
+        if (calendar != nullptr) {
+            day = calendar->newDate(bars.days()[day_index].date);
+            if (i == 0)
+                initial_day = day;
+        }
+        writeIndexLine(index_file, dataset_name, day++, first_bars[day_index], bars.days()[day_index].num_bars);
+    }
+
+    char init_buffer[formatted_date_size + 1]{};
+    formatDate(initial_day, init_buffer);
+    formatDate(day - 1, buffer);
+    log << "Writing " << dataset_name << " dataset from " << init_buffer << "  to " << buffer << endl;
+    return day;
+}
+
+} // namespace
+
+bool WriteSplits(const Options& options, const BarStore& bars, DayNumber initial_day, const std::filesystem::path& output_path, std::ostream& log,
+    FileStats& stats) {
+    const auto write_start = std::chrono::steady_clock::now();
+    uint64_t bytes_written = 0;
+
+    std::vector<uint64_t> first_bars; // index mode: index in bars file of each day's first bar
+    if (options.split_index) {
+        const std::filesystem::path path = splitPath(output_path, "bars", ".csv", options.output_compression);
+        if (!writeBarsFile(bars, path, options.output_compression, options.replace_outputs, first_bars, log, stats))
+            return false;
+    }
+
+    for (size_t split_number = 0; split_number < options.splits.size(); split_number++) {
+        const SplitConfig& split = options.splits[split_number];
+        const auto partition_start = std::chrono::steady_clock::now();
+        std::vector<uint32_t> dataset_days[3];
+        const SharedCalendar* calendar = options.universe != nullptr ? &options.universe->splits[split_number] : nullptr;
+        if (calendar != nullptr) {
+            if (!assignDatasets(bars.days(), *calendar, dataset_days, log))
+                return false;
+        }
+        else
+            assignDatasets(bars.days(), split.interval, split.ratio, split.offset, dataset_days);
+        stats.partition_seconds += secondsSince(partition_start);
+
+        // index files are small, so they're never compressed
+        const Compression compression = options.split_index ? Compression::none : options.output_compression;
+        const std::filesystem::path path = splitPath(output_path, split.name(), options.split_index ? ".idx" : ".csv", compression);
+        OutputWriter split_file(output_buffer_size, options.gather_writes);
+        if (!split_file.open(path, compression, options.replace_outputs)) {
+            log << "***Error*** Unable to create '" << path.string() << "' for writing." << endl;
+            return false;
+        }
+        log << "Split " << split.name() << " to '" << path.filename().string() << "'" << endl;
+
+        DayNumber next_day = initial_day;
+        if (options.split_index) {
+            split_file.write("Dataset,Date,FirstBar,Bars");
+            split_file.write(line_end);
+            for (int i = 0; i < 3; i++)
+                next_day = writeIndexFile(split_file, bars, first_bars, dataset_days[i], next_day, dataset_names[i], options.warmup_bars, calendar, log);
+        }
+        else {
+            writeHeader(split_file, options.warmup_bars > 0);
+            for (int i = 0; i < 3; i++)
+                next_day = writeOutputFile(split_file, bars, dataset_days[i], next_day, dataset_names[i], log, options.warmup_bars, calendar);
+        }
+        if (!split_file.close()) {
+            log << "***Error*** Unable to write '" << path.string() << "'. The disk might be full." << endl;
+            return false;
+        }
+        bytes_written += split_file.bytesWritten();
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start).count();
+    stats.write_seconds += seconds;
+    stats.bytes_written += bytes_written;
+    char message[100];
+    snprintf(message, sizeof(message), "Wrote %zu splits, %.1f MB in %.3f seconds", options.splits.size(), bytes_written / (1024.0 * 1024.0), seconds);
+    log << message << endl;
+    return true;
+}
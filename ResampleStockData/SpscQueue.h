@@ -0,0 +1,91 @@
+//
+// SpscQueue.h : bounded lock-free queue between one producer thread and one consumer thread
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// A ring of capacity slots. push waits while the queue is full and pop waits while it's empty, so a fast producer is
+// held back to the speed of its consumer. Either side may close the queue: after that push fails, and pop fails once
+// the queue is empty. Each side adds up the time it spent waiting, to show which end of the queue is holding up the other
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : slots_(capacity + 1) {}
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer only. Returns false, leaving item alone, if the queue was closed
+    bool push(T&& item) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t next = (tail + 1) % slots_.size();
+        if (!waitUntil([&] { return next != head_.load(std::memory_order_acquire); }, producer_wait_) || closed_.load(std::memory_order_acquire))
+            return false;
+        slots_[tail] = std::move(item);
+        tail_.store(next, std::memory_order_release);
+        signal();
+        return true;
+    }
+
+    // consumer only. Returns false if the queue is closed and there's nothing left in it
+    bool pop(T& item) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (!waitUntil([&] { return head != tail_.load(std::memory_order_acquire); }, consumer_wait_))
+            return false;
+        item = std::move(slots_[head]);
+        head_.store((head + 1) % slots_.size(), std::memory_order_release);
+        signal();
+        return true;
+    }
+
+    // no more items (from producer), or no more wanted (from consumer)
+    void close() {
+        closed_.store(true, std::memory_order_release);
+        signal();
+    }
+
+    // seconds each side spent waiting; read them once both sides are done
+    double producerWaitSeconds() const { return producer_wait_; }
+    double consumerWaitSeconds() const { return consumer_wait_; }
+
+private:
+    // waits until ready() or the queue is closed. Returns ready()
+    template <typename Ready>
+    bool waitUntil(Ready ready, double& wait_seconds) {
+        if (ready())
+            return true;
+        const auto wait_start = std::chrono::steady_clock::now();
+        bool is_ready;
+        waiting_.fetch_add(1);
+        while (true) {
+            // any push, pop or close after this changes changes_, so wait can't miss it
+            const uint32_t changes = changes_.load();
+            if ((is_ready = ready()) || closed_.load(std::memory_order_acquire))
+                break;
+            changes_.wait(changes);
+        }
+        waiting_.fetch_sub(1);
+        wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+        return is_ready;
+    }
+
+    // wakes the other side if it's waiting. Waking is a system call, so it's skipped when nobody waits
+    void signal() {
+        changes_.fetch_add(1);
+        if (waiting_.load() != 0)
+            changes_.notify_all();
+    }
+
+    std::vector<T> slots_;
+    alignas(64) std::atomic<size_t> head_{ 0 }; // next slot to pop
+    alignas(64) std::atomic<size_t> tail_{ 0 }; // next slot to push
+    alignas(64) std::atomic<uint32_t> changes_{ 0 };
+    std::atomic<int> waiting_{ 0 }; // # of sides waiting for a change
+    std::atomic<bool> closed_{ false };
+    double producer_wait_{ 0 };
+    double consumer_wait_{ 0 };
+};
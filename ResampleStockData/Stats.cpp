@@ -0,0 +1,166 @@
+//
+// Stats.cpp : timers and counters for each file resampled (--stats)
+//
+
+#include "Stats.h"
+#include "FieldScanner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+// set before main by AllocationCounter.cpp, if the program has it
+std::atomic<const std::atomic<uint64_t>*> allocation_counter{ nullptr };
+
+// one JSON object of stats, indented for the files array or not
+void writeStats(std::ostream& out, const FileStats& stats, const char* indent) {
+    char text[2000];
+    snprintf(text, sizeof(text),
+        "{\n"
+        "%s  \"ok\": %s,\n"
+        "%s  \"total_seconds\": %.6f, \"open_seconds\": %.6f, \"parse_seconds\": %.6f, \"date_seconds\": %.6f, \"filter_seconds\": %.6f,\n"
+        "%s  \"partition_seconds\": %.6f, \"write_seconds\": %.6f, \"sort_seconds\": %.6f,\n"
+        "%s  \"bytes_read\": %llu, \"bytes_written\": %llu, \"read_mb_per_second\": %.3f,\n"
+        "%s  \"lines\": %llu, \"bars_kept\": %llu, \"bars_discarded\": %llu, \"below_min_bars\": %llu, \"bad_bars\": %llu,\n"
+        "%s  \"days_read\": %llu, \"days_kept\": %llu, \"days_discarded\": %llu, \"duplicate_dates\": %llu,\n"
+        "%s  \"duplicate_bars\": %llu, \"sort_runs\": %llu,\n"
+        "%s  \"peak_memory_bytes\": %llu, \"allocations\": %lld\n"
+        "%s}",
+        indent, stats.ok ? "true" : "false",
+        indent, stats.total_seconds, stats.open_seconds, stats.parse_seconds, stats.date_seconds, stats.filter_seconds,
+        indent, stats.partition_seconds, stats.write_seconds, stats.sort_seconds,
+        indent, (unsigned long long)stats.bytes_read, (unsigned long long)stats.bytes_written,
+        stats.total_seconds > 0 ? stats.bytes_read / (1024.0 * 1024.0) / stats.total_seconds : 0.0,
+        indent, (unsigned long long)stats.lines, (unsigned long long)stats.bars_kept,
+        (unsigned long long)(stats.lines - std::min(stats.lines, stats.bars_kept)), (unsigned long long)stats.below_min_bars,
+        (unsigned long long)stats.bad_bars,
+        indent, (unsigned long long)stats.days_read, (unsigned long long)stats.days_kept,
+        (unsigned long long)(stats.days_read - std::min(stats.days_read, stats.days_kept)), (unsigned long long)stats.duplicate_dates,
+        indent, (unsigned long long)stats.duplicate_bars, (unsigned long long)stats.sort_runs,
+        indent, (unsigned long long)stats.peak_memory, (long long)stats.allocations,
+        indent);
+    out << text;
+}
+
+// file names go in JSON strings
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        if ((unsigned char)c < 0x20)
+            continue;
+        escaped += c;
+    }
+    return escaped;
+}
+
+} // namespace
+
+void FileStats::add(const FileStats& other) {
+    total_seconds += other.total_seconds;
+    open_seconds += other.open_seconds;
+    parse_seconds += other.parse_seconds;
+    date_seconds += other.date_seconds;
+    filter_seconds += other.filter_seconds;
+    partition_seconds += other.partition_seconds;
+    write_seconds += other.write_seconds;
+    sort_seconds += other.sort_seconds;
+    bytes_read += other.bytes_read;
+    bytes_written += other.bytes_written;
+    lines += other.lines;
+    days_read += other.days_read;
+    bars_kept += other.bars_kept;
+    days_kept += other.days_kept;
+    duplicate_dates += other.duplicate_dates;
+    below_min_bars += other.below_min_bars;
+    bad_bars += other.bad_bars;
+    duplicate_bars += other.duplicate_bars;
+    sort_runs += other.sort_runs;
+    peak_memory = std::max(peak_memory, other.peak_memory);
+    if (allocations >= 0 && other.allocations >= 0)
+        allocations += other.allocations;
+    else
+        allocations = -1;
+}
+
+void FileStats::restart() {
+    FileStats fresh;
+    fresh.file = file;
+    fresh.open_seconds = open_seconds;
+    *this = fresh;
+}
+
+uint64_t peakMemory() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss; // bytes
+#else
+    return (uint64_t)usage.ru_maxrss * 1024; // KB
+#endif
+#endif
+}
+
+void countAllocationsWith(const std::atomic<uint64_t>* counter) {
+    allocation_counter.store(counter);
+}
+
+bool allocationCount(uint64_t& count) {
+    const std::atomic<uint64_t>* counter = allocation_counter.load();
+    if (counter == nullptr)
+        return false;
+    count = counter->load(std::memory_order_relaxed);
+    return true;
+}
+
+bool WriteStatsFile(const std::filesystem::path& path, const std::vector<FileStats>& files, double wall_seconds) {
+    std::ofstream out(path);
+    if (!out)
+        return false;
+
+    FileStats total;
+    total.allocations = 0;
+    size_t failed = 0;
+    for (const FileStats& stats : files) {
+        total.add(stats);
+        if (!stats.ok)
+            failed++;
+    }
+    total.ok = failed == 0;
+    total.peak_memory = std::max(total.peak_memory, peakMemory());
+
+    char text[200];
+    snprintf(text, sizeof(text), "  \"wall_seconds\": %.6f, \"files\": %zu, \"failed_files\": %zu, \"read_mb_per_wall_second\": %.3f, \"simd\": \"%s\",\n",
+        wall_seconds, files.size(), failed, wall_seconds > 0 ? total.bytes_read / (1024.0 * 1024.0) / wall_seconds : 0.0, simdLevelName(simdLevel()));
+    out << "{\n" << text << "  \"total\": ";
+    writeStats(out, total, "  ");
+    out << ",\n  \"per_file\": [";
+    for (size_t i = 0; i < files.size(); i++) {
+        out << (i > 0 ? ",\n" : "\n") << "    { \"file\": \"" << jsonEscape(files[i].file) << "\", \"stats\": ";
+        writeStats(out, files[i], "      ");
+        out << " }";
+    }
+    out << "\n  ]\n}\n";
+    return (bool)out;
+}
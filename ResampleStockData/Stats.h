@@ -0,0 +1,87 @@
+//
+// Stats.h : timers and counters for each file resampled (--stats)
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// What resampling one file took. Times are in seconds. parse includes date conversion and filtering (and is what's
+// left of the time in a loop that also writes, in streaming mode); with parse threads, date conversion and filtering
+// are added up over the threads. In pipeline mode the phases overlap, so they can add up to more than total
+struct FileStats {
+    std::string file;
+    bool ok{ false };
+
+    double total_seconds{ 0 };
+    double open_seconds{ 0 };      // opening or mapping input and output files
+    double parse_seconds{ 0 };
+    double date_seconds{ 0 };      // date conversion, timed on a sample of lines
+    double filter_seconds{ 0 };    // minimum value filter, timed on a sample of lines
+    double partition_seconds{ 0 }; // sending days to data sets
+    double write_seconds{ 0 };
+    double sort_seconds{ 0 };      // --sort: sorting runs, writing them and merging them into longer ones
+
+    uint64_t bytes_read{ 0 };
+    uint64_t bytes_written{ 0 };   // including --splits files
+    uint64_t lines{ 0 };           // data lines, not counting header
+    uint64_t days_read{ 0 };       // runs of lines with the same date
+    uint64_t bars_kept{ 0 };
+    uint64_t days_kept{ 0 };
+    uint64_t duplicate_dates{ 0 }; // days thrown away because their date was seen before
+    uint64_t below_min_bars{ 0 };  // bars below minimum value, each throwing away its day's bars so far
+    uint64_t bad_bars{ 0 };        // bars skipped by --check-bars
+    uint64_t duplicate_bars{ 0 };  // --sort: lines dropped as exact copies of a line with the same date and time
+    uint64_t sort_runs{ 0 };       // --sort: sorted runs written to disk (0 if the input fit in memory)
+    uint64_t peak_memory{ 0 };     // of the whole process, as of the end of this file
+    int64_t allocations{ -1 };     // while resampling this file; -1 if not known (files resampled at the same time, or a program that doesn't count them)
+
+    // adds other's times and counts to these (peak memory is the larger of the two)
+    void add(const FileStats& other);
+    // back to no time and counts except open_seconds, to start over on a file
+    void restart();
+};
+
+inline double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Times a step done for every line by timing only every 64th time and multiplying by 64, so it costs a couple of clock
+// reads per 64 lines instead of per line
+class SampledTimer {
+public:
+    void start() {
+        sampling_ = (++count_ & (sample_every - 1)) == 0;
+        if (sampling_)
+            start_ = std::chrono::steady_clock::now();
+    }
+    // adds estimated time since start to seconds
+    void stop(double& seconds) {
+        if (sampling_) {
+            seconds += secondsSince(start_) * sample_every;
+            sampling_ = false;
+        }
+    }
+
+private:
+    static constexpr uint64_t sample_every = 64;
+    uint64_t count_{ 0 };
+    bool sampling_{ false };
+    std::chrono::steady_clock::time_point start_;
+};
+
+// peak memory of the process so far, in bytes; 0 if not known
+uint64_t peakMemory();
+// # of operator new calls so far, on all threads; false if this program doesn't count them (only the ResampleStockData
+// executable does, with AllocationCounter.cpp)
+bool allocationCount(uint64_t& count);
+// called by AllocationCounter.cpp, before main, with the counter its operator new adds to
+void countAllocationsWith(const std::atomic<uint64_t>* counter);
+
+// writes each file's stats, and their totals, as JSON. wall_seconds is the time the whole run took
+bool WriteStatsFile(const std::filesystem::path& path, const std::vector<FileStats>& files, double wall_seconds);
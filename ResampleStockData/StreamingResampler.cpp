@@ -0,0 +1,262 @@
+//
+// StreamingResampler.cpp : resamples a file without holding all of it in memory
+//
+// Each day is sent to its data set (by a DatasetWriter) as soon as its last bar has been read. Training days go straight
+// to the output file. Validation and test days can't, because their new dates depend on how many training days there
+// are, so they are written to spill files next to the output file and copied in after the last training day, with
+// their dates filled in. Memory use is one day of bars no matter how large the file is.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include "ResampleStockData.h"
+#include "LineHandler.h"
+#include "MappedFile.h"
+
+using std::endl;
+using std::string;
+
+void DayBuffer::setDate(DayNumber day) {
+    char buffer[formatted_date_size];
+    formatDate(day, buffer);
+    for (size_t start : line_starts_)
+        memcpy(text_.data() + start, buffer, formatted_date_size);
+}
+
+DayOrder checkDayOrder(std::vector<DayNumber>& saved_days, DayNumber day) {
+    if (!saved_days.empty() && day <= saved_days.back())
+        return std::binary_search(saved_days.begin(), saved_days.end(), day) ? DayOrder::duplicate : DayOrder::out_of_order;
+    saved_days.push_back(day);
+    return DayOrder::next;
+}
+
+bool DatasetWriter::open(const std::filesystem::path& output_path, std::ostream& log) {
+    spills_[0].path = output_path.string() + ".validation.spill";
+    spills_[1].path = output_path.string() + ".test.spill";
+    for (SpillFile& spill : spills_) {
+        if (!spill.writer.open(spill.path)) {
+            log << "***Error*** Unable to create '" << spill.path.string() << "'" << endl;
+            removeSpillFiles();
+            return false;
+        }
+    }
+    write_start_ = std::chrono::steady_clock::now();
+    return true;
+}
+
+void DatasetWriter::write(DayNumber day, DayBuffer& day_bars) {
+    const auto partition_start = std::chrono::steady_clock::now();
+    const DatasetAssigner::Dataset dataset = assigner_.assign(day);
+    const auto write_start = std::chrono::steady_clock::now();
+    stats_.partition_seconds += std::chrono::duration<double>(write_start - partition_start).count();
+    if (dataset == DatasetAssigner::training) {
+        day_bars.setDate(next_training_day_++);
+        output_file_.write(day_bars.text());
+    }
+    else {
+        SpillFile& spill = spills_[dataset - 1];
+        spill.writer.write(day_bars.text());
+        spill.bars_per_day.push_back(day_bars.numBars());
+    }
+    stats_.days_kept++;
+    stats_.bars_kept += day_bars.numBars();
+    day_bars.clear();
+    day_count_++;
+    stats_.write_seconds += secondsSince(write_start);
+}
+
+bool DatasetWriter::finish(std::ostream& log) {
+    const auto finish_start = std::chrono::steady_clock::now();
+    // check for no valid days
+    if (day_count_ == 0) {
+        log << "***Error*** After filtering for minimum value, input file is empty" << endl;
+        removeSpillFiles();
+        return false;
+    }
+
+    // training days are already in output file; validation and test days follow them
+    char init_buffer[formatted_date_size + 1]{};
+    char buffer[formatted_date_size + 1]{};
+    formatDate(initial_day_, init_buffer);
+    formatDate(next_training_day_ - 1, buffer);
+    log << "Writing training dataset from " << init_buffer << "  to " << buffer << endl;
+    bool ok = true;
+    DayNumber next_day = copySpillFile(spills_[0], next_training_day_, "validation", log, ok);
+    if (ok)
+        copySpillFile(spills_[1], next_day, "test", log, ok);
+    removeSpillFiles();
+    if (!ok)
+        return false;
+
+    if (!output_file_.close()) {
+        log << "***Error*** Unable to write output file. The disk might be full." << endl;
+        return false;
+    }
+    stats_.write_seconds += secondsSince(finish_start);
+
+    logWriteSpeed(output_file_, std::chrono::duration<double>(std::chrono::steady_clock::now() - write_start_).count(), log);
+    return true;
+}
+
+// copies the days in spill file to output file, dated from day on. Returns the day after the last one
+DayNumber DatasetWriter::copySpillFile(SpillFile& spill, DayNumber day, const string& dataset_name, std::ostream& log, bool& ok) {
+    const DayNumber initial_day = day;
+    char buffer[formatted_date_size + 1]{};
+
+    MappedFile mapped;
+    if (!spill.writer.close() || !mapped.open(spill.path)) {
+        log << "***Error*** Unable to write or read back '" << spill.path.string() << "'. The disk might be full." << endl;
+        ok = false;
+        return day;
+    }
+
+    const char* next = mapped.data();
+    const char* const end = next + mapped.size();
+    for (size_t num_bars : spill.bars_per_day) {
+        formatDate(day, buffer);
+        const std::string_view date(buffer, formatted_date_size);
+        for (size_t i = 0; i < num_bars && next < end; i++) {
+            const char* eol = (const char*)memchr(next, '\n', end - next);
+            eol = eol != nullptr ? eol + 1 : end;
+            output_file_.write(date);
+            output_file_.write(std::string_view(next + formatted_date_size, eol - next - formatted_date_size));
+            next = eol;
+        }
+        day++;
+    }
+
+    char init_buffer[formatted_date_size + 1]{};
+    formatDate(initial_day, init_buffer);
+    formatDate(day - 1, buffer);
+    log << "Writing " << dataset_name << " dataset from " << init_buffer << "  to " << buffer << endl;
+    return day;
+}
+
+void DatasetWriter::removeSpillFiles() {
+    std::error_code ec;
+    for (SpillFile& spill : spills_) {
+        if (spill.path.empty())
+            continue;
+        spill.writer.close();
+        std::filesystem::remove(spill.path, ec);
+        spill.path.clear();
+    }
+}
+
+bool ProcessCSVFileStreaming(const Options& options, const std::filesystem::path& input_path, OutputWriter& output_file,
+    const std::filesystem::path& output_path, std::ostream& log, FileStats& stats) {
+    const auto open_start = std::chrono::steady_clock::now();
+    // input is read a line at a time, either from a memory mapping or with std::getline (always, for a compressed file)
+    const Compression compression = compressionOf(input_path);
+    const bool mapped = options.io_mode == IOMode::mmap && compression == Compression::none;
+    MappedFile mapped_file;
+    std::ifstream plain_file;
+    DecompressingStream compressed_file;
+    std::istream& input_file = compression != Compression::none ? (std::istream&)compressed_file : plain_file;
+    string stream_line, spare_line;
+    const char* next = nullptr;
+    const char* end = nullptr;
+    if (mapped) {
+        if (!mapped_file.open(input_path)) {
+            log << "***Error*** Unable to open '" << input_path << "' for reading." << endl;
+            return false;
+        }
+        next = mapped_file.data();
+        end = next + mapped_file.size();
+    }
+    else {
+        if (compression != Compression::none)
+            compressed_file.open(input_path, compression);
+        else
+            plain_file.open(input_path);
+        if (!input_file.rdbuf() || !input_file.good()) {
+            log << "***Error*** Unable to open '" << input_path << "' for reading." << endl;
+            return false;
+        }
+    }
+    stats.open_seconds += secondsSince(open_start);
+    auto readLine = [&](std::string_view& line) {
+        if (mapped)
+            return nextLine(next, end, line);
+        // read into a spare string, so a failed read leaves the last line intact for error messages
+        if (!std::getline(input_file, spare_line))
+            return false;
+        stream_line.swap(spare_line);
+        line = stream_line;
+        return true;
+    };
+
+    // read header;
+    std::string_view line;
+    if (!readLine(line)) {
+        log << "***Error*** Inout file is empty" << endl;
+        return false;
+    }
+    if (line != "\"Date\",\"Time\",\"Open\",\"High\",\"Low\",\"Close\",\"Up\",\"Down\"" && line != "Date,Time,Open,High,Low,Close,Up,Down")
+        log << "***Warning*** First line is not expected header:" << "Date,Time,Open,High,Low,Close,Up,Down" << endl;
+
+    // write header to output file
+    writeHeader(output_file);
+
+    DatasetWriter dataset_writer(options, output_file, stats);
+    if (!dataset_writer.open(output_path, log))
+        return false;
+    std::vector<DayNumber> saved_days; // in increasing order, to find duplicates
+    bool input_ok = true;
+    LineHandler handler(options, stats, log);
+    bool writer_started = false;
+
+    // sends a complete day to its data set. Returns false if the date was seen before
+    auto saveDay = [&](DayNumber day, DayBuffer& day_bars) {
+        const DayOrder order = checkDayOrder(saved_days, day);
+        if (order == DayOrder::duplicate) {
+            day_bars.clear();
+            return false;
+        }
+        if (order == DayOrder::out_of_order) {
+            char buffer[formatted_date_size + 1]{};
+            formatDate(day, buffer);
+            log << "***Error*** Date out of order (streaming requires ascending dates): " << buffer << endl;
+            input_ok = false;
+            return true;
+        }
+        // training days are dated from the first date, even if that day had no bars
+        if (!writer_started) {
+            dataset_writer.start(handler.initialDay());
+            writer_started = true;
+        }
+        dataset_writer.write(day, day_bars);
+        return true;
+    };
+
+    // Read data, line by line. Days are written as they are read, so parse time is what's left after partition and write
+    const auto parse_start = std::chrono::steady_clock::now();
+    const double written_before = stats.partition_seconds + stats.write_seconds;
+    DayBuffer bars_for_day;
+    DayBufferBars day_bars(bars_for_day, saveDay);
+    while (input_ok && readLine(line))
+    {
+        stats.lines++;
+        if (!handler.handle(line, day_bars)) {
+            input_ok = false;
+            break;
+        }
+    }
+
+    if (input_ok && !mapped)
+        input_ok = inputStreamOk(input_file, log);
+
+    // save last day
+    if (input_ok)
+        handler.finish(line, day_bars);
+    stats.parse_seconds = secondsSince(parse_start) - (stats.partition_seconds + stats.write_seconds - written_before);
+    if (compression != Compression::none)
+        logDecompression(compressed_file, log);
+
+    if (!input_ok)
+        return false;
+    return dataset_writer.finish(log);
+}
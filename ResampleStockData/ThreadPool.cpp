@@ -0,0 +1,54 @@
+//
+// ThreadPool.cpp : fixed size thread pool that starts tasks in the order they were submitted
+//
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned num_threads) {
+    if (num_threads == 0)
+        num_threads = 1;
+    for (unsigned i = 0; i < num_threads; i++)
+        threads_.emplace_back(&ThreadPool::run, this);
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    task_available_.notify_all();
+    for (std::thread& thread : threads_)
+        thread.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+        unfinished_++;
+    }
+    task_available_.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    all_done_.wait(lock, [this] { return unfinished_ == 0; });
+}
+
+void ThreadPool::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        task_available_.wait(lock, [this] { return !tasks_.empty() || stopping_; });
+        if (tasks_.empty())
+            return; // stopping, and nothing left to do
+        std::function<void()> task = std::move(tasks_.front());
+        tasks_.pop_front();
+
+        lock.unlock();
+        task();
+        lock.lock();
+        if (--unfinished_ == 0)
+            all_done_.notify_all();
+    }
+}
@@ -0,0 +1,39 @@
+//
+// ThreadPool.h : fixed size thread pool that starts tasks in the order they were submitted
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// the tasks wait in one queue, and a worker that's free takes the oldest. So if tasks are submitted largest first, the
+// largest remaining task is always run next. Meant for a few big tasks (files, chunks of a file), not many tiny ones
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned num_threads);
+    ~ThreadPool(); // waits for all submitted tasks to finish
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    // blocks until every submitted task has finished
+    void wait();
+    unsigned size() const { return (unsigned)threads_.size(); }
+
+private:
+    void run();
+
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable task_available_;
+    std::condition_variable all_done_;
+    std::deque<std::function<void()>> tasks_; // not yet taken by a worker, oldest first
+    size_t unfinished_{ 0 };                  // tasks submitted, not yet finished
+    bool stopping_{ false };
+};
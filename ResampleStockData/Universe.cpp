@@ -0,0 +1,190 @@
+//
+// Universe.cpp : --universe, one calendar for all the files in the directory
+//
+// Without it, each file's periods are counted from that file's own first date, so the same week can be training data
+// in one file and test data in another. With it, the dates of every file are collected first (in parallel, reading
+// just the date column), and the periods of that one calendar are dealt out to the data sets once. Every file is then
+// split by that table, so a date goes to the same data set, with the same new date, in every output file
+//
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ResampleStockData.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+using std::endl;
+using std::string;
+
+namespace {
+
+// adds the date of every line of input (after the header) to days, once per run of lines with the same date
+class DateCollector {
+public:
+    explicit DateCollector(std::vector<DayNumber>& days) : days_(days) {}
+
+    bool header_read{ false };
+
+    bool add(std::string_view line, std::ostream& log) {
+        if (!header_read) {
+            header_read = true;
+            return true;
+        }
+        const size_t comma = line.find(',');
+        const std::string_view date = line.substr(0, comma);
+        if (date == previous_)
+            return true;
+        DayNumber day;
+        if (!DateStringToDayNumber(line, date, date_parser_, day, log))
+            return false;
+        if (days_.empty() || days_.back() != day)
+            days_.push_back(day);
+        previous_.assign(date);
+        return true;
+    }
+
+private:
+    std::vector<DayNumber>& days_;
+    DateParser date_parser_;
+    string previous_;
+};
+
+// the dates of one input file, in the order they appear. A plain file is mapped; a compressed one is read through a
+// DecompressingStream
+bool collectDates(const std::filesystem::path& path, std::vector<DayNumber>& days, std::ostream& log) {
+    DateCollector collector(days);
+    const Compression compression = compressionOf(path);
+    if (compression == Compression::none) {
+        MappedFile mapped_file;
+        if (!mapped_file.open(path)) {
+            log << "***Error*** Unable to open '" << path << "' for reading." << endl;
+            return false;
+        }
+        const char* next = mapped_file.data();
+        const char* end = next + mapped_file.size();
+        std::string_view line;
+        while (nextLine(next, end, line)) {
+            if (!collector.add(line, log))
+                return false;
+        }
+        return true;
+    }
+
+    DecompressingStream input_file;
+    if (!input_file.open(path, compression)) {
+        log << "***Error*** Unable to open '" << path << "' for reading." << endl;
+        return false;
+    }
+    string line;
+    while (std::getline(input_file, line)) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!collector.add(line, log))
+            return false;
+    }
+    return inputStreamOk(input_file, log);
+}
+
+} // namespace
+
+SharedCalendar::SharedCalendar(const std::vector<DayNumber>& days, const Interval& interval, const std::vector<int>& ratio, int offset) {
+    if (days.empty())
+        return;
+    first_ = days.front();
+    entries_.resize((size_t)(days.back() - first_) + 1);
+
+    // deal out the periods as assignDatasets does for one file, then number the days of each data set in date order,
+    // training first, as writeOutputFile would
+    DatasetAssigner assigner(interval, ratio, offset);
+    const CalendarIndex calendar(interval, days.front(), days.back());
+    for (const DayNumber day : days) {
+        const DatasetAssigner::Dataset dataset = assigner.assignPeriod(calendar.period(day));
+        entries_[day - first_].dataset = (int8_t)dataset;
+        day_counts_[dataset]++;
+    }
+    DayNumber next_day[3] = { first_, first_ + (DayNumber)day_counts_[0], first_ + (DayNumber)(day_counts_[0] + day_counts_[1]) };
+    for (const DayNumber day : days) {
+        Entry& entry = entries_[day - first_];
+        entry.new_date = next_day[entry.dataset]++;
+    }
+}
+
+bool SharedCalendar::find(DayNumber day, DatasetAssigner::Dataset& dataset) const {
+    if (day < first_ || (size_t)(day - first_) >= entries_.size() || entries_[day - first_].dataset < 0)
+        return false;
+    dataset = (DatasetAssigner::Dataset)entries_[day - first_].dataset;
+    return true;
+}
+
+std::shared_ptr<const Universe> BuildUniverse(const Options& options, const std::vector<std::filesystem::path>& paths, std::ostream& log) {
+    const auto start = std::chrono::steady_clock::now();
+
+    // each file's dates, read at the same time with the same number of threads as the files will be resampled with
+    std::vector<std::vector<DayNumber>> file_days(paths.size());
+    std::vector<bool> file_ok(paths.size());
+    std::mutex log_mutex;
+    {
+        ThreadPool pool(options.num_threads);
+        for (size_t i = 0; i < paths.size(); i++) {
+            pool.submit([&, i] {
+                std::ostringstream file_log;
+                file_ok[i] = collectDates(paths[i], file_days[i], file_log);
+                if (!file_ok[i]) {
+                    std::lock_guard<std::mutex> lock(log_mutex);
+                    log << file_log.str() << "***Warning*** '" << paths[i].filename().string() << "' was left out of the shared calendar" << endl;
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    std::vector<DayNumber> days;
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (file_ok[i])
+            days.insert(days.end(), file_days[i].begin(), file_days[i].end());
+    }
+    std::sort(days.begin(), days.end());
+    days.erase(std::unique(days.begin(), days.end()), days.end());
+    if (days.empty()) {
+        log << "***Error*** No dates found for the shared calendar" << endl;
+        return nullptr;
+    }
+
+    auto universe = std::make_shared<Universe>(Universe{ SharedCalendar(days, options.interval, options.ratio, 0), {} });
+    for (const SplitConfig& split : options.splits)
+        universe->splits.emplace_back(days, split.interval, split.ratio, split.offset);
+
+    char first[formatted_date_size + 1]{};
+    char last[formatted_date_size + 1]{};
+    formatDate(days.front(), first);
+    formatDate(days.back(), last);
+    const SharedCalendar& calendar = universe->calendar;
+    char message[300];
+    snprintf(message, sizeof(message), "Shared calendar of %zu files: %zu days from %s to %s (training %zu, validation %zu, test %zu) in %.3f seconds",
+        paths.size(), days.size(), first, last, calendar.dayCount(DatasetAssigner::training), calendar.dayCount(DatasetAssigner::validation),
+        calendar.dayCount(DatasetAssigner::test), secondsSince(start));
+    log << message << endl;
+    return universe;
+}
+
+bool assignDatasets(std::span<const BarStore::Day> days, const SharedCalendar& calendar, std::vector<uint32_t>(&dataset_days)[3], std::ostream& log) {
+    for (uint32_t i = 0; i < (uint32_t)days.size(); i++) {
+        DatasetAssigner::Dataset dataset;
+        if (!calendar.find(days[i].date, dataset)) {
+            char buffer[formatted_date_size + 1]{};
+            formatDate(days[i].date, buffer);
+            log << "***Error*** " << buffer << " isn't in the shared calendar; the file must have changed after the calendar was made" << endl;
+            return false;
+        }
+        dataset_days[dataset].push_back(i);
+    }
+    return true;
+}
@@ -0,0 +1,472 @@
+//
+// Watcher.cpp : --watch, a daemon that resamples each file of the directory again whenever it changes
+//
+// A normal run parses every file from scratch. Watching, each file's text and parsed bars are kept in memory between
+// changes, up to --watch-memory MB (the files used least recently are let go first). inotify says which files
+// changed; a file is resampled once it has had no events for --watch-debounce ms, so a burst of writes is one update.
+// If the file only grew (bars appended), just the new lines and the last day before them are parsed, and the bars
+// before that are kept. Anything else, or a file that was let go, is parsed again from scratch. Output files are
+// written as .tmp files and renamed over the old ones, so a reader never sees half an output file
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ResampleStockData.h"
+#include "ThreadPool.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using std::cout;
+using std::endl;
+using std::string;
+
+namespace {
+
+// a watched file, and (if warm) its parsed bars as of size and mtime
+struct WatchedFile {
+    std::filesystem::path path;
+    bool warm{ false };
+    bool busy{ false };              // being resampled; can't be let go
+    uint64_t last_used{ 0 };         // for letting go of the least recently used files first
+    uint64_t memory{ 0 };            // text and bars, roughly, as of the last time it was resampled
+
+    std::deque<string> texts;        // the whole file, then each appended part (from resume_offset on). Bars are views of them
+    std::deque<uint64_t> text_offsets; // in the file, of each of texts
+    BarStore bars;
+    std::vector<TextArena> owned_text;
+    DayNumber initial_day{ 0 };
+    uint64_t size{ 0 };
+    int64_t mtime{ 0 };
+
+    bool appendable{ false };        // new lines can be parsed on to bars
+    uint64_t resume_offset{ 0 };     // first line of the file's last day, which is parsed again with the new lines
+    size_t resume_days{ 0 };         // # of days of bars before that day
+
+    void forget() {
+        warm = false;
+        texts.clear();
+        text_offsets.clear();
+        bars = BarStore();
+        owned_text.clear();
+    }
+
+    uint64_t memoryInUse() const {
+        if (!warm)
+            return 0;
+        uint64_t bytes = bars.barCount() * sizeof(BarView) + bars.days().size() * sizeof(BarStore::Day);
+        for (const string& text : texts)
+            bytes += text.capacity();
+        return bytes;
+    }
+};
+
+// reads path from offset on into text; false if it can't be read
+bool readFrom(const std::filesystem::path& path, uint64_t offset, string& text) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file || !file.seekg((std::streamoff)offset))
+        return false;
+    constexpr size_t block_size = 1024 * 1024;
+    size_t used = 0;
+    while (file) {
+        text.resize(used + block_size);
+        file.read(text.data() + used, block_size);
+        used += (size_t)file.gcount();
+    }
+    text.resize(used);
+    return file.eof();
+}
+
+// a compressed file, decompressed into text
+bool readCompressed(const std::filesystem::path& path, Compression compression, string& text, std::ostream& log) {
+    DecompressingStream input_file;
+    if (!input_file.open(path, compression)) {
+        log << "***Error*** Unable to open '" << path << "' for reading." << endl;
+        return false;
+    }
+    constexpr size_t block_size = 1024 * 1024;
+    size_t used = 0;
+    while (input_file) {
+        text.resize(used + block_size);
+        input_file.read(text.data() + used, block_size);
+        used += (size_t)input_file.gcount();
+    }
+    text.resize(used);
+    return inputStreamOk(input_file, log);
+}
+
+// where the last day of text[first_line, end) starts: the first of the lines at its end with the date of the last
+// line, which goes to last_date. npos if there are no lines
+size_t lastDayStart(std::string_view text, size_t first_line, DayNumber& last_date) {
+    std::ostringstream ignored;
+    DateParser date_parser;
+    size_t start = string::npos;
+    size_t line_end = text.size();
+    if (line_end > first_line && text[line_end - 1] == '\n')
+        line_end--;
+    while (line_end > first_line) {
+        const size_t newline = text.rfind('\n', line_end - 1);
+        const size_t line_start = newline == string::npos || newline < first_line ? first_line : newline + 1;
+        std::string_view line = text.substr(line_start, line_end - line_start);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        DayNumber day;
+        if (!DateStringToDayNumber(line, line.substr(0, line.find(',')), date_parser, day, ignored))
+            return string::npos;
+        if (start != string::npos && day != last_date)
+            return start;
+        last_date = day;
+        start = line_start;
+        if (line_start == first_line)
+            break;
+        line_end = line_start - 1;
+    }
+    return start;
+}
+
+class Watcher {
+public:
+    explicit Watcher(const Options& options) : options_(options), memory_budget_((uint64_t)options.watch_memory_mb * 1024 * 1024) {}
+
+    // resamples the named files of the directory (new ones are added), on options.num_threads threads
+    void resample(const std::vector<string>& names);
+    // a file that's gone is no longer watched; its output files are left as they are
+    void remove(const string& name);
+
+private:
+    // resamples file if it changed since it was last resampled; changed says whether it did
+    bool update(WatchedFile& file, bool& changed, std::ostream& log);
+    bool parse(WatchedFile& file, bool appended, std::ostream& log);
+    bool appendedTo(const WatchedFile& file) const;
+    // lets go of the least recently used files until the warm ones fit in the memory budget. mutex_ must be held
+    void keepWithinBudget();
+
+    const Options& options_;
+    const uint64_t memory_budget_; // 0 = no limit
+    std::map<string, WatchedFile> files_; // by file name
+    std::mutex mutex_;                    // last_used, memory and busy, and letting go of files, while files are resampled
+    uint64_t clock_{ 0 };
+};
+
+void Watcher::resample(const std::vector<string>& names) {
+    std::vector<WatchedFile*> batch;
+    for (const string& name : names) {
+        auto found = files_.find(name);
+        if (found == files_.end()) {
+            // e.g. a.csv.gz turning up next to a.csv
+            const string stem = csvStem(name);
+            bool clash = false;
+            for (const auto& [other, file] : files_)
+                clash = clash || csvStem(other) == stem;
+            if (clash) {
+                cout << "***Error*** More than one input file would be resampled to '" << stem << "_resampled.csv'; '" << name << "' is ignored" << endl;
+                continue;
+            }
+            found = files_.emplace(name, WatchedFile{}).first;
+            found->second.path = options_.directory / name;
+        }
+        found->second.busy = true;
+        batch.push_back(&found->second);
+    }
+
+    std::mutex cout_mutex;
+    auto run = [&](WatchedFile& file) {
+        std::ostringstream log;
+        bool changed = false;
+        const auto start = std::chrono::steady_clock::now();
+        const bool ok = update(file, changed, log);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            file.busy = false;
+            file.last_used = ++clock_;
+            file.memory = file.memoryInUse();
+            keepWithinBudget();
+        }
+        if (!changed && ok)
+            return;
+        if (ok) {
+            char message[100];
+            snprintf(message, sizeof(message), "Updated in %.3f seconds", secondsSince(start));
+            log << message << endl;
+        }
+        std::lock_guard<std::mutex> lock(cout_mutex);
+        cout << log.str() << std::flush;
+    };
+    if (options_.num_threads > 1 && batch.size() > 1) {
+        ThreadPool pool(options_.num_threads);
+        for (WatchedFile* file : batch)
+            pool.submit([&run, file] { run(*file); });
+        pool.wait();
+    }
+    else {
+        for (WatchedFile* file : batch)
+            run(*file);
+    }
+}
+
+void Watcher::remove(const string& name) {
+    if (files_.erase(name) > 0)
+        cout << endl << "'" << name << "' was removed; its output files were left as they are" << endl;
+}
+
+bool Watcher::update(WatchedFile& file, bool& changed, std::ostream& log) {
+    const string input_filename = file.path.filename().string();
+    std::error_code ec;
+    const uint64_t size = std::filesystem::file_size(file.path, ec);
+    const int64_t mtime = modificationTime(file.path);
+    if (ec) {
+        log << "***Error*** Unable to open '" << file.path << "' for reading." << endl;
+        file.forget();
+        return false;
+    }
+    if (file.warm && size == file.size && mtime == file.mtime)
+        return true;
+    changed = true;
+
+    const Compression compression = compressionOf(file.path);
+    if (!compressionSupported(compression)) {
+        log << "***Error*** This build can't read " << compressionName(compression) << " files, so '" << input_filename << "' was skipped" << endl;
+        return false;
+    }
+    const string output_filename = csvStem(file.path) + "_resampled.csv" + compressionExtension(options_.output_compression);
+    const string full_output_filename = file.path.parent_path().string() + "/ResampledData/" + output_filename;
+
+    // parse just what was appended, if that's all that happened, or the whole file
+    FileStats stats;
+    stats.file = input_filename;
+    const bool appended = file.warm && file.appendable && size > file.size && appendedTo(file);
+    if (appended)
+        log << endl << "Resampling '" << input_filename << "' (" << size - file.size << " bytes appended) to update '" << output_filename << endl;
+    else
+        log << endl << "Resampling '" << input_filename << "' to create '" << output_filename << endl;
+    file.mtime = mtime;
+    if (!parse(file, appended, log)) {
+        file.forget();
+        return false;
+    }
+
+    OutputWriter resampled_csv_file(output_buffer_size, options_.gather_writes);
+    if (!resampled_csv_file.open(full_output_filename, options_.output_compression, true)) {
+        log << "***Error*** Unable to create '" << full_output_filename << "' for writing. It might be locked by another program." << endl;
+        return false;
+    }
+    writeHeader(resampled_csv_file, options_.warmup_bars > 0);
+    return ResampleBars(options_, file.bars, file.initial_day, resampled_csv_file, log, stats);
+}
+
+// every byte of the file parsed last time is still the same, so the file was only appended to. The file is read from
+// the start and compared with texts: each part of it as it was is in the text that was parsed last from there on
+bool Watcher::appendedTo(const WatchedFile& file) const {
+    std::ifstream input(file.path, std::ios::binary);
+    if (!input)
+        return false;
+    constexpr size_t block_size = 1024 * 1024;
+    std::vector<char> block(block_size);
+    for (size_t i = 0; i < file.texts.size(); i++) {
+        const uint64_t part_end = i + 1 < file.texts.size() ? file.text_offsets[i + 1] : file.size;
+        std::string_view part = std::string_view(file.texts[i]).substr(0, (size_t)(part_end - file.text_offsets[i]));
+        while (!part.empty()) {
+            const size_t size = std::min(block_size, part.size());
+            if (!input.read(block.data(), (std::streamsize)size) || memcmp(block.data(), part.data(), size) != 0)
+                return false;
+            part.remove_prefix(size);
+        }
+    }
+    return true;
+}
+
+bool Watcher::parse(WatchedFile& file, bool appended, std::ostream& log) {
+    const Compression compression = compressionOf(file.path);
+    FileStats stats;
+    uint64_t text_offset = 0; // in the file, of texts.back()
+    size_t first_line = 0;    // in texts.back(), after the header
+    if (appended) {
+        string& text = file.texts.emplace_back();
+        file.text_offsets.push_back(file.resume_offset);
+        if (!readFrom(file.path, file.resume_offset, text)) {
+            log << "***Error*** Unable to read '" << file.path << "'." << endl;
+            return false;
+        }
+        // the last day might have gained bars, so it's parsed again along with the new days
+        const DayNumber initial_day = file.initial_day;
+        file.bars.truncateDays(file.resume_days);
+        if (!ParseCSVLines(options_, text, file.bars, file.owned_text, file.initial_day, log, stats))
+            return false;
+        file.initial_day = initial_day;
+        text_offset = file.resume_offset;
+    }
+    else {
+        file.forget();
+        string& text = file.texts.emplace_back();
+        file.text_offsets.push_back(0);
+        if (compression != Compression::none ? !readCompressed(file.path, compression, text, log) : !readFrom(file.path, 0, text)) {
+            log << "***Error*** Unable to read '" << file.path << "'." << endl;
+            return false;
+        }
+        if (!ParseCSVText(options_, text, file.bars, file.owned_text, file.initial_day, log, stats))
+            return false;
+        const size_t eol = text.find('\n');
+        first_line = eol == string::npos ? text.size() : eol + 1;
+        file.appendable = compression == Compression::none;
+    }
+    const string& text = file.texts.back();
+    file.size = text_offset + text.size();
+    file.warm = true;
+
+    // where the next append carries on from. Days out of order or duplicated would need all of them parsed again
+    DayNumber last_date = 0;
+    const size_t last_day = lastDayStart(text, first_line, last_date);
+    file.appendable = file.appendable && file.bars.ascending() && stats.duplicate_dates == 0 && last_day != string::npos;
+    if (file.appendable) {
+        file.resume_offset = text_offset + last_day;
+        file.resume_days = file.bars.days().size();
+        if (!file.bars.empty() && file.bars.days().back().date == last_date)
+            file.resume_days--;
+    }
+    return true;
+}
+
+void Watcher::keepWithinBudget() {
+    if (memory_budget_ == 0)
+        return;
+    uint64_t memory = 0;
+    for (const auto& [name, file] : files_)
+        memory += file.memory;
+    while (memory > memory_budget_) {
+        WatchedFile* oldest = nullptr;
+        for (auto& [name, file] : files_) {
+            if (!file.busy && file.warm && (oldest == nullptr || file.last_used < oldest->last_used))
+                oldest = &file;
+        }
+        if (oldest == nullptr)
+            break;
+        memory -= oldest->memory;
+        oldest->forget();
+        oldest->memory = 0;
+    }
+}
+
+#ifdef __linux__
+volatile std::sig_atomic_t stop_requested = 0;
+
+void requestStop(int) {
+    stop_requested = 1;
+}
+#endif
+
+} // namespace
+
+#ifdef __linux__
+bool WatchDirectory(const Options& options, const std::vector<std::filesystem::path>& paths) {
+    const int inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, options.directory.c_str(),
+        IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+        cout << "***Error*** Unable to watch '" << options.directory.string() << "'" << endl;
+        if (inotify_fd >= 0)
+            close(inotify_fd);
+        return false;
+    }
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    // every file as it is now, then the ones that change
+    Watcher watcher(options);
+    std::vector<string> names;
+    for (const std::filesystem::path& path : paths)
+        names.push_back(path.filename().string());
+    watcher.resample(names);
+    cout << endl << "Watching '" << options.directory.string() << "' for changes (Ctrl+C to stop)" << endl;
+
+    using Clock = std::chrono::steady_clock;
+    const auto debounce = std::chrono::milliseconds(options.watch_debounce_ms);
+    std::map<string, Clock::time_point> pending; // changed files, by time of their last event
+    bool ok = true;
+    alignas(inotify_event) char events[64 * 1024];
+    while (!stop_requested) {
+        // wait until the first pending file has been quiet long enough, or for the next event
+        int timeout_ms = 500;
+        const Clock::time_point now = Clock::now();
+        for (const auto& [name, last_event] : pending) {
+            const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(last_event + debounce - now).count();
+            timeout_ms = std::min<int>(timeout_ms, (int)std::max<int64_t>(wait, 0));
+        }
+        pollfd poll_fd{ inotify_fd, POLLIN, 0 };
+        const int ready = poll(&poll_fd, 1, timeout_ms);
+        if (ready < 0 && errno != EINTR) {
+            cout << "***Error*** Unable to wait for changes to '" << options.directory.string() << "'" << endl;
+            ok = false;
+            break;
+        }
+
+        if (ready > 0) {
+            const ssize_t length = read(inotify_fd, events, sizeof(events));
+            const Clock::time_point event_time = Clock::now();
+            for (ssize_t offset = 0; offset < length;) {
+                const inotify_event* event = (const inotify_event*)(events + offset);
+                offset += sizeof(inotify_event) + event->len;
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    cout << "***Error*** '" << options.directory.string() << "' was removed or moved" << endl;
+                    stop_requested = 1;
+                    ok = false;
+                }
+                // events were lost, so look at every file
+                else if (event->mask & IN_Q_OVERFLOW) {
+                    std::error_code ec;
+                    for (const auto& entry : std::filesystem::directory_iterator(options.directory, ec)) {
+                        if (isCsvFile(entry.path()))
+                            pending[entry.path().filename().string()] = event_time;
+                    }
+                }
+                else if (event->len > 0 && !(event->mask & IN_ISDIR) && isCsvFile(event->name))
+                    pending[event->name] = event_time;
+            }
+        }
+
+        // resample the files which have been quiet for the debounce time. What happened to them is seen from the
+        // files themselves, not from the events
+        std::vector<string> due;
+        const Clock::time_point quiet_since = Clock::now() - debounce;
+        for (auto it = pending.begin(); it != pending.end();) {
+            if (it->second > quiet_since) {
+                ++it;
+                continue;
+            }
+            std::error_code ec;
+            if (std::filesystem::is_regular_file(options.directory / it->first, ec))
+                due.push_back(it->first);
+            else
+                watcher.remove(it->first);
+            it = pending.erase(it);
+        }
+        if (!due.empty() && !stop_requested)
+            watcher.resample(due);
+    }
+
+    close(inotify_fd);
+    if (ok)
+        cout << endl << "Stopped watching '" << options.directory.string() << "'" << endl;
+    return ok;
+}
+#else
+bool WatchDirectory(const Options& options, const std::vector<std::filesystem::path>& paths) {
+    (void)options;
+    (void)paths;
+    cout << "***Error*** --watch needs inotify, so it only works on Linux" << endl;
+    return false;
+}
+#endif